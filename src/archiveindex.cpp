@@ -0,0 +1,261 @@
+/*
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This file is part of Mod Organizer.
+
+Mod Organizer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Mod Organizer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Mod Organizer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "archiveindex.h"
+
+#include <algorithm>
+
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+
+#include <log.h>
+
+using namespace MOBase;
+
+namespace {
+
+  // little-endian readers over a raw buffer, the caller is responsible for
+  // checking the bounds
+  std::uint16_t read16(const char* p) {
+    auto* u = reinterpret_cast<const unsigned char*>(p);
+    return static_cast<std::uint16_t>(u[0] | (u[1] << 8));
+  }
+
+  std::uint32_t read32(const char* p) {
+    return read16(p) | (static_cast<std::uint32_t>(read16(p + 2)) << 16);
+  }
+
+  std::uint64_t read64(const char* p) {
+    return read32(p) | (static_cast<std::uint64_t>(read32(p + 4)) << 32);
+  }
+
+  constexpr std::uint32_t ZIP_EOCD_SIGNATURE = 0x06054b50;
+  constexpr std::uint32_t ZIP64_EOCD_LOCATOR_SIGNATURE = 0x07064b50;
+  constexpr std::uint32_t ZIP64_EOCD_SIGNATURE = 0x06064b50;
+  constexpr std::uint32_t ZIP_CENTRAL_HEADER_SIGNATURE = 0x02014b50;
+
+  constexpr int ZIP_EOCD_SIZE = 22;
+  constexpr int ZIP64_EOCD_LOCATOR_SIZE = 20;
+  constexpr int ZIP_CENTRAL_HEADER_SIZE = 46;
+
+  // the EOCD record ends with a comment of at most 65535 bytes
+  constexpr int ZIP_MAX_EOCD_SEARCH = ZIP_EOCD_SIZE + 0xFFFF;
+
+}
+
+QString ArchiveIndex::normalize(QString path)
+{
+  path.replace('\\', '/');
+  while (path.endsWith('/')) {
+    path.chop(1);
+  }
+  return path.toLower();
+}
+
+ArchiveIndex ArchiveIndex::read(QString path)
+{
+  QFileInfo info(path);
+  if (info.isDir()) {
+    return readDirectory(path);
+  }
+
+  QFile file(path);
+  if (!file.open(QIODevice::ReadOnly)) {
+    return ArchiveIndex();
+  }
+
+  ArchiveIndex index = readZip(file);
+  if (!index.isValid()) {
+    index = readOpaque(path);
+  }
+  return index;
+}
+
+ArchiveIndex ArchiveIndex::readDirectory(QString path)
+{
+  ArchiveIndex index;
+  index.m_Valid = true;
+  index.m_HasSizes = true;
+
+  QDir root(path);
+  QDirIterator it(path, QDir::Files | QDir::Hidden | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+  while (it.hasNext()) {
+    it.next();
+    Entry entry;
+    entry.size = entry.packedSize = it.fileInfo().size();
+    entry.block = index.m_Blocks.size();
+    index.m_Blocks.push_back({ entry.size, entry.packedSize });
+    index.m_ArchiveSize += entry.size;
+    index.m_Entries.emplace(normalize(root.relativeFilePath(it.filePath())), entry);
+  }
+
+  return index;
+}
+
+ArchiveIndex ArchiveIndex::readOpaque(QString path)
+{
+  // without any information on the content, we consider the whole archive
+  // as a single solid block
+  ArchiveIndex index;
+  index.m_Valid = true;
+  index.m_Solid = true;
+  index.m_ArchiveSize = QFileInfo(path).size();
+  index.m_Blocks.push_back({ 0, index.m_ArchiveSize });
+  return index;
+}
+
+ArchiveIndex ArchiveIndex::readZip(QIODevice& device)
+{
+  const qint64 deviceSize = device.size();
+  if (deviceSize < ZIP_EOCD_SIZE) {
+    return ArchiveIndex();
+  }
+
+  // find the end of central directory record, from the end
+  const qint64 searchSize = std::min<qint64>(deviceSize, ZIP_MAX_EOCD_SEARCH);
+  if (!device.seek(deviceSize - searchSize)) {
+    return ArchiveIndex();
+  }
+  const QByteArray tail = device.read(searchSize);
+  if (tail.size() != searchSize) {
+    return ArchiveIndex();
+  }
+
+  int eocd = -1;
+  for (int i = tail.size() - ZIP_EOCD_SIZE; i >= 0; --i) {
+    if (read32(tail.constData() + i) == ZIP_EOCD_SIGNATURE) {
+      eocd = i;
+      break;
+    }
+  }
+  if (eocd < 0) {
+    return ArchiveIndex();
+  }
+
+  const char* p = tail.constData() + eocd;
+  std::uint64_t count = read16(p + 10);
+  std::uint64_t cdSize = read32(p + 12);
+  std::uint64_t cdOffset = read32(p + 16);
+
+  // ZIP64 archives store the real values in a separate record, located by a
+  // locator record just before the EOCD
+  if (count == 0xFFFF || cdSize == 0xFFFFFFFF || cdOffset == 0xFFFFFFFF) {
+    if (eocd < ZIP64_EOCD_LOCATOR_SIZE
+      || read32(p - ZIP64_EOCD_LOCATOR_SIZE) != ZIP64_EOCD_LOCATOR_SIGNATURE) {
+      return ArchiveIndex();
+    }
+    const std::uint64_t zip64Offset = read64(p - ZIP64_EOCD_LOCATOR_SIZE + 8);
+    if (!device.seek(zip64Offset)) {
+      return ArchiveIndex();
+    }
+    const QByteArray zip64 = device.read(56);
+    if (zip64.size() != 56 || read32(zip64.constData()) != ZIP64_EOCD_SIGNATURE) {
+      return ArchiveIndex();
+    }
+    count = read64(zip64.constData() + 32);
+    cdSize = read64(zip64.constData() + 40);
+    cdOffset = read64(zip64.constData() + 48);
+  }
+
+  // the values are untrusted, reject anything that wraps around or points past
+  // the end of the archive
+  const std::uint64_t available = static_cast<std::uint64_t>(deviceSize);
+  if (cdOffset > available || cdSize > available - cdOffset || !device.seek(cdOffset)) {
+    return ArchiveIndex();
+  }
+
+  const QByteArray cd = device.read(cdSize);
+  if (static_cast<std::uint64_t>(cd.size()) != cdSize) {
+    return ArchiveIndex();
+  }
+
+  ArchiveIndex index;
+  index.m_ArchiveSize = deviceSize;
+  // every central header takes at least ZIP_CENTRAL_HEADER_SIZE bytes, which
+  // bounds the reservation whatever the record claims
+  index.m_Entries.reserve(std::min<std::uint64_t>(count, cdSize / ZIP_CENTRAL_HEADER_SIZE));
+
+  const char* begin = cd.constData();
+  const char* end = begin + cd.size();
+  for (const char* h = begin; h + ZIP_CENTRAL_HEADER_SIZE <= end; ) {
+    if (read32(h) != ZIP_CENTRAL_HEADER_SIGNATURE) {
+      return ArchiveIndex();
+    }
+
+    const std::uint16_t flags = read16(h + 8);
+    const std::uint16_t nameLength = read16(h + 28);
+    const std::uint16_t extraLength = read16(h + 30);
+    const std::uint16_t commentLength = read16(h + 32);
+
+    const char* name = h + ZIP_CENTRAL_HEADER_SIZE;
+    const char* extra = name + nameLength;
+    const char* next = extra + extraLength + commentLength;
+    if (next > end) {
+      return ArchiveIndex();
+    }
+
+    Entry entry;
+    entry.method = read16(h + 10);
+    entry.crc = read32(h + 16);
+    entry.hasCrc = true;
+    entry.packedSize = read32(h + 20);
+    entry.size = read32(h + 24);
+    entry.offset = read32(h + 42);
+
+    // the ZIP64 extended information only contains the fields that overflowed,
+    // in a fixed order
+    for (const char* e = extra; e + 4 <= extra + extraLength; ) {
+      const std::uint16_t id = read16(e), length = read16(e + 2);
+      if (id == 0x0001) {
+        const char* f = e + 4;
+        const char* fEnd = f + length;
+        if (entry.size == 0xFFFFFFFF && f + 8 <= fEnd) { entry.size = read64(f); f += 8; }
+        if (entry.packedSize == 0xFFFFFFFF && f + 8 <= fEnd) { entry.packedSize = read64(f); f += 8; }
+        if (entry.offset == 0xFFFFFFFF && f + 8 <= fEnd) { entry.offset = read64(f); f += 8; }
+        break;
+      }
+      e += 4 + length;
+    }
+
+    // bit 11 indicates UTF-8 names, otherwise this is supposed to be CP437 but most
+    // tools use the local code page
+    const QString path = (flags & 0x0800)
+      ? QString::fromUtf8(name, nameLength) : QString::fromLocal8Bit(name, nameLength);
+
+    if (!path.endsWith('/')) {
+      entry.block = index.m_Blocks.size();
+      index.m_Blocks.push_back({ entry.size, entry.packedSize });
+      index.m_Entries.emplace(normalize(path), entry);
+    }
+
+    h = next;
+  }
+
+  index.m_Valid = true;
+  index.m_HasSizes = true;
+  return index;
+}
+
+const ArchiveIndex::Entry* ArchiveIndex::find(QString path) const
+{
+  auto it = m_Entries.find(normalize(path));
+  return it == m_Entries.end() ? nullptr : &it->second;
+}
@@ -0,0 +1,145 @@
+/*
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This file is part of Mod Organizer.
+
+Mod Organizer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Mod Organizer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Mod Organizer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ARCHIVEINDEX_H
+#define ARCHIVEINDEX_H
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include <QIODevice>
+#include <QString>
+
+// index of an archive, i.e. the list of files it contains with their sizes, read
+// directly from the archive without extracting anything
+//
+// the IFileTree given to installers does not contain any size information, so this
+// is used to estimate the cost of an installation
+//
+// only ZIP archives (and extracted directories) can be fully indexed, other formats
+// (7z, rar, ...) only provide the size of the archive itself and are considered to
+// be a single solid block
+//
+class ArchiveIndex {
+public:
+
+  struct Entry {
+
+    // uncompressed and compressed size of the file
+    std::uint64_t size = 0;
+    std::uint64_t packedSize = 0;
+
+    // CRC-32 of the file, if provided by the archive
+    std::uint32_t crc = 0;
+    bool hasCrc = false;
+
+    // the block containing this file, for non-solid archives each file is
+    // in its own block
+    std::size_t block = 0;
+
+    // offset of the local header of this file in the archive (ZIP only) and
+    // compression method
+    std::uint64_t offset = 0;
+    std::uint16_t method = 0;
+  };
+
+  struct Block {
+
+    // total uncompressed size of the files in this block, and compressed size
+    // of the block
+    std::uint64_t size = 0;
+    std::uint64_t packedSize = 0;
+  };
+
+public:
+
+  /**
+   * @brief Read the index of the archive (or directory) at the given path.
+   *
+   * @param path Path to the archive or directory.
+   *
+   * @return the index, which is invalid if the path could not be read.
+   */
+  static ArchiveIndex read(QString path);
+
+  /**
+   * @brief Read the central directory of a ZIP archive from the given device.
+   *
+   * @param device The device to read, must be open and seekable.
+   *
+   * @return the index, which is invalid if the device is not a ZIP archive.
+   */
+  static ArchiveIndex readZip(QIODevice& device);
+
+  /**
+   * @brief Normalize the given path so that it can be used to look up an entry.
+   */
+  static QString normalize(QString path);
+
+public:
+
+  ArchiveIndex() = default;
+
+  // check if this index has been read successfully
+  //
+  bool isValid() const { return m_Valid; }
+
+  // check if this index contains per-file sizes, if false, the only information
+  // available is the size of the archive (as a single solid block)
+  //
+  bool hasSizes() const { return m_HasSizes; }
+
+  // check if this index contains blocks containing multiple files
+  //
+  bool isSolid() const { return m_Solid; }
+
+  // retrieve the size of the archive itself
+  //
+  std::uint64_t archiveSize() const { return m_ArchiveSize; }
+
+  // retrieve the entry for the given path (relative to the archive root), or a null
+  // pointer if the path is not in the index
+  //
+  const Entry* find(QString path) const;
+
+  // retrieve the blocks of the archive
+  //
+  const std::vector<Block>& blocks() const { return m_Blocks; }
+
+  // retrieve all the entries in the index, indexed by normalized path
+  //
+  const std::unordered_map<QString, Entry>& entries() const { return m_Entries; }
+
+private:
+
+  static ArchiveIndex readDirectory(QString path);
+  static ArchiveIndex readOpaque(QString path);
+
+  bool m_Valid = false;
+  bool m_HasSizes = false;
+  bool m_Solid = false;
+  std::uint64_t m_ArchiveSize = 0;
+
+  std::unordered_map<QString, Entry> m_Entries;
+  std::vector<Block> m_Blocks;
+
+};
+
+#endif // ARCHIVEINDEX_H
@@ -0,0 +1,324 @@
+/*
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This file is part of Mod Organizer.
+
+Mod Organizer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Mod Organizer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Mod Organizer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "archivestatistics.h"
+#include "fileclassifier.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <unordered_map>
+
+using namespace MOBase;
+
+using Index = FlatFileTree::Index;
+
+// number of nodes processed by a worker at once
+static constexpr std::size_t CHUNK_SIZE = 16384;
+
+// call fn(begin, end, worker) for consecutive chunks of [0, count) from the given
+// number of threads, worker being the index of the calling thread
+//
+template <class Fn>
+static void parallelChunks(std::size_t count, int threads, Fn&& fn)
+{
+  const std::size_t chunks = (count + CHUNK_SIZE - 1) / CHUNK_SIZE;
+  std::atomic<std::size_t> next = 0;
+  auto worker = [&](int w) {
+    for (std::size_t c = next++; c < chunks; c = next++) {
+      fn(c * CHUNK_SIZE, std::min(count, (c + 1) * CHUNK_SIZE), w);
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (int w = 1; w < std::min<int>(threads, static_cast<int>(chunks)); ++w) {
+    workers.emplace_back(worker, w);
+  }
+  worker(0);
+  for (auto& thread : workers) {
+    thread.join();
+  }
+}
+
+static void add(ArchiveStatistics::Totals& totals, ArchiveStatistics::Totals const& other)
+{
+  totals.files += other.files;
+  totals.bytes += other.bytes;
+}
+
+static std::size_t fanoutBucket(std::size_t children)
+{
+  std::size_t bucket = 0;
+  while (children > 0) {
+    children >>= 1;
+    ++bucket;
+  }
+  return bucket;
+}
+
+ArchiveStatistics::ArchiveStatistics(std::shared_ptr<const FlatFileTree> tree, int threads) :
+  m_Tree(tree), m_ExtensionOf(tree->size(), NO_GROUP), m_TopLevelOf(tree->size(), NO_GROUP),
+  m_Selected(tree->size(), true)
+{
+  if (threads <= 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  // extensions of the distinct names, computed in parallel and then numbered
+  auto const& names = tree->names();
+  std::vector<QString> suffixes(names.size());
+  parallelChunks(names.size(), threads, [&](std::size_t begin, std::size_t end, int) {
+    for (std::size_t i = begin; i < end; ++i) {
+      const int dot = names[i].lastIndexOf('.');
+      if (dot > 0) {
+        suffixes[i] = names[i].mid(dot + 1).toLower();
+      }
+    }
+  });
+
+  std::vector<std::uint32_t> extensionOfName(names.size());
+  std::unordered_map<QString, std::uint32_t> extensionIds;
+  for (std::size_t i = 0; i < names.size(); ++i) {
+    auto [it, added] = extensionIds.try_emplace(suffixes[i], static_cast<std::uint32_t>(m_Extensions.size()));
+    if (added) {
+      m_Extensions.push_back({ suffixes[i], {}, {} });
+    }
+    extensionOfName[i] = it->second;
+  }
+
+  // top-level folders are ranges of the image, files under the root come last
+  const std::size_t rootChildren = tree->size() > 0 ? tree->childCount(0) : 0;
+  for (std::size_t k = 0; k < rootChildren; ++k) {
+    const Index child = tree->child(0, k);
+    if (tree->isDir(child)) {
+      const auto id = static_cast<std::uint32_t>(m_TopLevel.size());
+      m_TopLevel.push_back({ tree->name(child), {}, {} });
+      std::fill(m_TopLevelOf.begin() + child, m_TopLevelOf.begin() + tree->subtreeEnd(child), id);
+    }
+  }
+  const auto rootGroup = static_cast<std::uint32_t>(m_TopLevel.size());
+  m_TopLevel.push_back({ QString(), {}, {} });
+
+  // the reduction itself, each worker accumulates in its own partial result
+  struct Partial {
+    std::vector<Totals> extensions, topLevel, depths;
+    std::vector<std::size_t> fanouts;
+  };
+  std::vector<Partial> partials(threads);
+  for (auto& partial : partials) {
+    partial.extensions.resize(m_Extensions.size());
+    partial.topLevel.resize(m_TopLevel.size());
+  }
+
+  parallelChunks(tree->size(), threads, [&](std::size_t begin, std::size_t end, int w) {
+    auto& partial = partials[w];
+    for (std::size_t i = begin; i < end; ++i) {
+      const auto index = static_cast<Index>(i);
+      if (tree->isDir(index)) {
+        const std::size_t bucket = fanoutBucket(tree->childCount(index));
+        if (partial.fanouts.size() <= bucket) {
+          partial.fanouts.resize(bucket + 1);
+        }
+        ++partial.fanouts[bucket];
+        continue;
+      }
+
+      const Totals file{ 1, tree->bytes(index) };
+
+      m_ExtensionOf[i] = extensionOfName[tree->nameIndices()[i]];
+      add(partial.extensions[m_ExtensionOf[i]], file);
+
+      if (m_TopLevelOf[i] == NO_GROUP) {
+        m_TopLevelOf[i] = rootGroup;
+      }
+      add(partial.topLevel[m_TopLevelOf[i]], file);
+
+      const std::size_t depth = tree->depth(index);
+      if (partial.depths.size() <= depth) {
+        partial.depths.resize(depth + 1);
+      }
+      add(partial.depths[depth], file);
+    }
+  });
+
+  for (auto& partial : partials) {
+    for (std::size_t i = 0; i < partial.extensions.size(); ++i) {
+      add(m_Extensions[i].total, partial.extensions[i]);
+    }
+    for (std::size_t i = 0; i < partial.topLevel.size(); ++i) {
+      add(m_TopLevel[i].total, partial.topLevel[i]);
+    }
+    if (m_Depths.size() < partial.depths.size()) {
+      m_Depths.resize(partial.depths.size());
+    }
+    for (std::size_t i = 0; i < partial.depths.size(); ++i) {
+      add(m_Depths[i].total, partial.depths[i]);
+    }
+    if (m_Fanouts.size() < partial.fanouts.size()) {
+      m_Fanouts.resize(partial.fanouts.size());
+    }
+    for (std::size_t i = 0; i < partial.fanouts.size(); ++i) {
+      m_Fanouts[i] += partial.fanouts[i];
+    }
+  }
+
+  for (std::size_t i = 0; i < m_Depths.size(); ++i) {
+    m_Depths[i].name = QString::number(i);
+  }
+
+  // names of directories produce extensions without any file
+  std::vector<std::uint32_t> remap(m_Extensions.size(), NO_GROUP);
+  std::vector<Group> extensions;
+  for (std::size_t i = 0; i < m_Extensions.size(); ++i) {
+    if (m_Extensions[i].total.files > 0) {
+      remap[i] = static_cast<std::uint32_t>(extensions.size());
+      extensions.push_back(std::move(m_Extensions[i]));
+    }
+  }
+  m_Extensions = std::move(extensions);
+  for (auto& extension : m_ExtensionOf) {
+    if (extension != NO_GROUP) {
+      extension = remap[extension];
+    }
+  }
+
+  // categories only depend on the extension, so their totals are those of their
+  // extensions, and only the categories with files are kept
+  std::vector<std::uint32_t> categoryIds(static_cast<std::size_t>(FileCategory::COUNT), NO_GROUP);
+  m_CategoryOf.resize(m_Extensions.size());
+  for (std::size_t i = 0; i < m_Extensions.size(); ++i) {
+    const auto category = static_cast<std::size_t>(FileClassifier::classify(FileClassifier::key(m_Extensions[i].name)));
+    if (categoryIds[category] == NO_GROUP) {
+      categoryIds[category] = static_cast<std::uint32_t>(m_Categories.size());
+      m_Categories.push_back({ FileClassifier::name(static_cast<FileCategory>(category)), {}, {} });
+    }
+    m_CategoryOf[i] = categoryIds[category];
+    add(m_Categories[m_CategoryOf[i]].total, m_Extensions[i].total);
+  }
+
+  // the root is not a file of the archive, and everything starts selected
+  m_Selected[0] = false;
+  for (auto& group : m_Extensions) {
+    add(m_Total.total, group.total);
+    group.selected = group.total;
+  }
+  for (auto& group : m_Categories) {
+    group.selected = group.total;
+  }
+  for (auto& group : m_TopLevel) {
+    group.selected = group.total;
+  }
+  for (auto& group : m_Depths) {
+    group.selected = group.total;
+  }
+  m_Total.selected = m_Total.total;
+}
+
+void ArchiveStatistics::update(Index i, bool selected)
+{
+  if (m_Tree->isDir(i) || m_Selected[i] == selected) {
+    return;
+  }
+  m_Selected[i] = selected;
+
+  const std::uint64_t bytes = m_Tree->bytes(i);
+  auto apply = [&](Totals& totals) {
+    if (selected) {
+      totals.files += 1;
+      totals.bytes += bytes;
+    }
+    else {
+      totals.files -= 1;
+      totals.bytes -= bytes;
+    }
+  };
+
+  apply(m_Total.selected);
+  apply(m_Extensions[m_ExtensionOf[i]].selected);
+  apply(m_Categories[m_CategoryOf[m_ExtensionOf[i]]].selected);
+  apply(m_TopLevel[m_TopLevelOf[i]].selected);
+  apply(m_Depths[m_Tree->depth(i)].selected);
+}
+
+void ArchiveStatistics::setSelected(const FileTreeEntry* entry, bool selected)
+{
+  const Index i = m_Tree->find(entry);
+  if (i != FlatFileTree::NO_INDEX) {
+    update(i, selected);
+  }
+}
+
+void ArchiveStatistics::setAllSelected(bool selected)
+{
+  for (std::size_t i = 1; i < m_Tree->size(); ++i) {
+    if (m_Tree->isFile(static_cast<Index>(i))) {
+      m_Selected[i] = selected;
+    }
+  }
+
+  auto reset = [selected](Group& group) {
+    group.selected = selected ? group.total : Totals{};
+  };
+  reset(m_Total);
+  std::for_each(m_Extensions.begin(), m_Extensions.end(), reset);
+  std::for_each(m_Categories.begin(), m_Categories.end(), reset);
+  std::for_each(m_TopLevel.begin(), m_TopLevel.end(), reset);
+  std::for_each(m_Depths.begin(), m_Depths.end(), reset);
+}
+
+QString ArchiveStatistics::fanoutLabel(std::size_t bucket)
+{
+  if (bucket <= 1) {
+    return QString::number(bucket);
+  }
+  const std::uint64_t low = std::uint64_t(1) << (bucket - 1);
+  return QString("%1-%2").arg(static_cast<qulonglong>(low)).arg(static_cast<qulonglong>(2 * low - 1));
+}
+
+QString ArchiveStatistics::toCsv() const
+{
+  // names can contain commas, so they are always quoted
+  auto quote = [](QString name) {
+    return "\"" + name.replace("\"", "\"\"") + "\"";
+  };
+
+  QString csv;
+  auto section = [&](QString const& kind, std::vector<Group> const& groups) {
+    for (auto& group : groups) {
+      csv += QString("%1,%2,%3,%4,%5,%6\n")
+        .arg(kind).arg(quote(group.name))
+        .arg(static_cast<qulonglong>(group.total.files)).arg(static_cast<qulonglong>(group.total.bytes))
+        .arg(static_cast<qulonglong>(group.selected.files)).arg(static_cast<qulonglong>(group.selected.bytes));
+    }
+  };
+
+  csv += "kind,name,files,bytes,selected files,selected bytes\n";
+  section("total", { m_Total });
+  section("extension", m_Extensions);
+  section("category", m_Categories);
+  section("top-level folder", m_TopLevel);
+  section("depth", m_Depths);
+
+  csv += "\nfan-out,directories\n";
+  for (std::size_t i = 0; i < m_Fanouts.size(); ++i) {
+    csv += QString("%1,%2\n").arg(fanoutLabel(i)).arg(static_cast<qulonglong>(m_Fanouts[i]));
+  }
+
+  return csv;
+}
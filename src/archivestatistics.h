@@ -0,0 +1,128 @@
+/*
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This file is part of Mod Organizer.
+
+Mod Organizer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Mod Organizer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Mod Organizer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ARCHIVESTATISTICS_H
+#define ARCHIVESTATISTICS_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <QString>
+
+#include "flattree.h"
+
+// composition of an archive: files and bytes per extension, per category of file,
+// per top-level folder and per depth, and histogram of the fan-out of the directories
+//
+// the statistics are computed once from the flat image of the original archive in
+// a single parallel pass, and then track which files are selected (checked), which
+// only costs a constant time per file whose state changed
+//
+// files are grouped by their position in the original archive, so moving files
+// around does not change the groups they belong to
+//
+class ArchiveStatistics {
+public:
+
+  struct Totals {
+    std::size_t files = 0;
+    std::uint64_t bytes = 0;
+  };
+
+  struct Group {
+    QString name;
+    Totals total;
+    Totals selected;
+  };
+
+public:
+
+  /**
+   * @brief Compute the statistics of the given image, with all the files selected.
+   *
+   * @param tree The flat image of the archive.
+   * @param threads Number of threads to use, or 0 to use the number of cores.
+   */
+  ArchiveStatistics(std::shared_ptr<const FlatFileTree> tree, int threads = 0);
+
+  // change the selection state of the given file, entries that are not files of
+  // the original archive are ignored
+  //
+  void setSelected(const MOBase::FileTreeEntry* entry, bool selected);
+
+  // change the selection state of all the files
+  //
+  void setAllSelected(bool selected);
+
+  // totals over the whole archive
+  //
+  Group const& total() const { return m_Total; }
+
+  // groups, extensions are lowercase and without the leading dot, files without
+  // an extension are in a group with an empty name, files directly under the root
+  // of the archive are in the last top-level group, with an empty name
+  //
+  std::vector<Group> const& extensions() const { return m_Extensions; }
+  std::vector<Group> const& categories() const { return m_Categories; }
+  std::vector<Group> const& topLevelFolders() const { return m_TopLevel; }
+  std::vector<Group> const& depths() const { return m_Depths; }
+
+  // number of directories whose number of children is in [2^(i-1), 2^i), except for
+  // the first bucket which counts empty directories
+  //
+  std::vector<std::size_t> const& fanouts() const { return m_Fanouts; }
+
+  // the label of the given fan-out bucket (e.g. "4-7")
+  //
+  static QString fanoutLabel(std::size_t bucket);
+
+  // export the statistics as comma-separated values, with one section per kind
+  // of group
+  //
+  QString toCsv() const;
+
+private:
+
+  static constexpr std::uint32_t NO_GROUP = static_cast<std::uint32_t>(-1);
+
+  void update(FlatFileTree::Index i, bool selected);
+
+  std::shared_ptr<const FlatFileTree> m_Tree;
+
+  // groups of each node (only meaningful for files)
+  std::vector<std::uint32_t> m_ExtensionOf;
+  std::vector<std::uint32_t> m_TopLevelOf;
+
+  // category of each extension, files are only classified through their extension
+  std::vector<std::uint32_t> m_CategoryOf;
+
+  // selection state of each node
+  std::vector<bool> m_Selected;
+
+  Group m_Total;
+  std::vector<Group> m_Extensions;
+  std::vector<Group> m_Categories;
+  std::vector<Group> m_TopLevel;
+  std::vector<Group> m_Depths;
+  std::vector<std::size_t> m_Fanouts;
+
+};
+
+#endif // ARCHIVESTATISTICS_H
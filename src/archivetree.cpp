@@ -18,10 +18,20 @@ along with Mod Organizer.  If not, see <http://www.gnu.org/licenses/>.
 */
 
 #include "archivetree.h"
+#include "stallwatchdog.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
 
 #include <QDragMoveEvent>
 #include <QDebug>
+#include <QLocale>
 #include <QMessageBox>
+#include <QStyledItemDelegate>
 
 #include <ifiletree.h>
 #include <log.h>
@@ -48,8 +58,11 @@ using namespace MOBase;
 // by the ArchiveTreeWidget. This signal is used to avoid having to connect to the itemChanged()
 // signal or overriding the dataChanged() method which are called much more often than those.
 // The treeCheckStateChanged() signal is send only for the item that has actually been changed
-// by the user. While the interface is automatically updated by Qt, we need to update the
-// underlying tree manually. This is done by doing the following things:
+// by the user. Changes made by the user are detected by the item delegate of the widget
+// (see CheckStateDelegate), and changes made by the widget itself go through setItemCheckState(),
+// so the states set by Qt when propagating the tristate are never intercepted. While the
+// interface is automatically updated by Qt, we need to update the underlying tree manually.
+// This is done by doing the following things:
 //   1) When an item is unchecked:
 //      - We detach the corresponding entry from its parent, and recursively detach the empty
 //        parents (or the ones that become empty).
@@ -63,6 +76,50 @@ using namespace MOBase;
 // is created in an empty directory, we need to re-attach), or when an item is moved (if the
 // directory the item comes from is now empty or if the target directory was empty).
 //
+// Directories with a very large number of entries can be paged (see setPaging()): only
+// the first entries get an item, and the other ones are held by a placeholder item that
+// is the last child of the directory. The placeholder has no entry, but has the check
+// state of all its pending entries, so the tristate of the directory is correct, and it
+// receives the state of the directory when the directory is (un)checked. Pending entries
+// are detached and re-inserted along with the other children, and get an item when the
+// user asks for them.
+//
+
+// rough memory footprint of an item, excluding its text
+//
+static constexpr std::uint64_t ITEM_BYTES = 200;
+
+// the estimated memory footprint of the children of the given item, recursively
+// or not
+//
+static std::uint64_t childrenBytes(const QTreeWidgetItem* item, bool recursive)
+{
+  std::uint64_t bytes = 0;
+  for (int i = 0; i < item->childCount(); ++i) {
+    bytes += ITEM_BYTES + sizeof(QChar) * item->child(i)->text(0).size();
+    if (recursive) {
+      bytes += childrenBytes(item->child(i), true);
+    }
+  }
+  return bytes;
+}
+
+// the number of items to create for a directory with count entries
+//
+static std::size_t pageLimit(std::size_t count, std::size_t threshold, std::size_t pageSize)
+{
+  return threshold > 0 && count > threshold ? std::min(count, pageSize) : count;
+}
+
+// the prefix of the paths of the children of the given directory, shown as their
+// tooltip, the path of the directory is built once for all its children instead of
+// once per child
+//
+static QString childPathPrefix(FileTreeEntry const& directory)
+{
+  const QString path = directory.path();
+  return path.isEmpty() ? path : path + "\\";
+}
 
 ArchiveTreeWidgetItem::ArchiveTreeWidgetItem(QString dataName)
   : QTreeWidgetItem(QStringList(dataName)), m_Entry(nullptr) {
@@ -71,102 +128,1087 @@ ArchiveTreeWidgetItem::ArchiveTreeWidgetItem(QString dataName)
   m_Populated = true;
 }
 
-ArchiveTreeWidgetItem::ArchiveTreeWidgetItem(std::shared_ptr<MOBase::FileTreeEntry> entry)
-  : QTreeWidgetItem(QStringList(entry->name())), m_Entry(entry)
+ArchiveTreeWidgetItem::ArchiveTreeWidgetItem(std::shared_ptr<MOBase::FileTreeEntry> entry)
+  : QTreeWidgetItem(QStringList(entry->name())), m_Entry(entry)
+{
+  if (entry->isDir()) {
+    setChildIndicatorPolicy(QTreeWidgetItem::ShowIndicator);
+    setFlags(flags() | Qt::ItemIsUserCheckable | Qt::ItemIsAutoTristate);
+  }
+  else if (NestedArchive::isSupported(entry->name())) {
+    // nested archives can be expanded to list their content
+    m_Nested = true;
+    setChildIndicatorPolicy(QTreeWidgetItem::ShowIndicator);
+    setFlags(flags() | Qt::ItemIsUserCheckable);
+  }
+  else {
+    setFlags(flags() | Qt::ItemIsUserCheckable | Qt::ItemNeverHasChildren);
+  }
+  setCheckState(0, Qt::Checked);
+}
+
+ArchiveTreeWidgetItem::ArchiveTreeWidgetItem(QString name, bool directory, std::uint64_t size)
+  : QTreeWidgetItem(QStringList(name)), m_Entry(nullptr), m_Listed(true)
+{
+  if (directory) {
+    setFlags(Qt::ItemIsEnabled);
+  }
+  else {
+    setFlags(Qt::ItemIsEnabled | Qt::ItemNeverHasChildren);
+    setToolTip(0, QLocale().formattedDataSize(static_cast<qint64>(size)));
+  }
+  m_Populated = true;
+}
+
+ArchiveTreeWidgetItem::~ArchiveTreeWidgetItem()
+{
+  if (m_Budget != nullptr) {
+    m_Budget->forget(m_BudgetCache, this);
+  }
+  if (m_ListingWidget != nullptr) {
+    m_ListingWidget->m_Listings.erase(this);
+  }
+  if (m_Listing.valid()) {
+    if (auto items = m_Listing.get()) {
+      qDeleteAll(*items);
+    }
+  }
+}
+
+ArchiveTreeWidgetItem::ArchiveTreeWidgetItem(std::vector<std::shared_ptr<MOBase::FileTreeEntry>> pending, Qt::CheckState state)
+  : QTreeWidgetItem(), m_Entry(nullptr), m_Placeholder(true), m_Pending(std::move(pending))
+{
+  // the placeholder cannot be checked, selected or dragged by the user, its state
+  // only follows the state of its parent
+  setFlags(Qt::ItemIsEnabled | Qt::ItemNeverHasChildren);
+  setCheckState(0, state);
+
+  QFont font = this->font(0);
+  font.setItalic(true);
+  setFont(0, font);
+
+  m_Populated = true;
+  updatePlaceholder();
+}
+
+void ArchiveTreeWidgetItem::updatePlaceholder()
+{
+  setText(0, ArchiveTreeWidget::tr("%1 more entries...").arg(QLocale().toString(static_cast<qulonglong>(m_Pending.size()))));
+  setToolTip(0, ArchiveTreeWidget::tr("Double-click to show more entries."));
+}
+
+void ArchiveTreeWidgetItem::populate(bool force) {
+
+  // Only populates once:
+  if (isPopulated() && !force) {
+    return;
+  }
+
+  // Should never happen:
+  if (entry()->isFile()) {
+    return;
+  }
+
+  // the path of the directory is built once, for the watchdog and the tooltips of
+  // the children
+  const QString prefix = childPathPrefix(*entry());
+  StallWatchdog::Scope scope("populate", prefix);
+
+  const Qt::CheckState state = flags().testFlag(Qt::ItemIsUserCheckable) ? checkState(0) : Qt::Checked;
+
+  // Wide directories only get items for their first entries:
+  auto* tree = static_cast<ArchiveTreeWidget*>(treeWidget());
+  auto entries = entry()->astree();
+  const std::size_t shown = tree != nullptr ? tree->pageLimit(entries->size()) : entries->size();
+
+  // The children may have been prepared in the background during a drag:
+  auto prefetched = tree != nullptr && !force ? tree->takePrefetched(this) : std::nullopt;
+  if (prefetched && prefetched->size() == shown) {
+    for (auto* newItem : *prefetched) {
+      newItem->setCheckState(0, state);
+      newItem->setToolTip(0, prefix + newItem->entry()->name());
+    }
+    addChildren(QList<QTreeWidgetItem*>(prefetched->begin(), prefetched->end()));
+  }
+  else {
+    if (prefetched) {
+      qDeleteAll(*prefetched);
+    }
+
+    // We go in reverse of the tree because we want to insert the original
+    // entries at the beginning (the item can only contains children if a
+    // directory has been created under it or if entries has been moved under
+    // it):
+    const auto end = std::next(entries->begin(), shown);
+    for (auto it = entries->begin(); it != end; ++it) {
+      auto newItem = new ArchiveTreeWidgetItem(*it);
+      newItem->setCheckState(0, state);
+      newItem->setToolTip(0, prefix + (*it)->name());
+      addChild(newItem);
+    }
+  }
+
+  if (shown < entries->size()) {
+    addChild(new ArchiveTreeWidgetItem(
+      std::vector<std::shared_ptr<FileTreeEntry>>(std::next(entries->begin(), shown), entries->end()), state));
+  }
+
+  // If the item is unchecked, we need to clear it because it has not been cleared
+  // before:
+  if (flags().testFlag(Qt::ItemIsUserCheckable) && checkState(0) == Qt::Unchecked) {
+    entry()->astree()->clear();
+  }
+
+  m_Populated = true;
+}
+
+// delegate of the tree widget, all the check state changes made by the user (mouse or
+// keyboard) go through editorEvent()
+//
+class CheckStateDelegate : public QStyledItemDelegate
+{
+public:
+
+  CheckStateDelegate(ArchiveTreeWidget* tree) : QStyledItemDelegate(tree), m_Tree(tree) { }
+
+  bool editorEvent(QEvent* event, QAbstractItemModel* model,
+    const QStyleOptionViewItem& option, const QModelIndex& index) override
+  {
+    const QVariant before = index.data(Qt::CheckStateRole);
+    if (!QStyledItemDelegate::editorEvent(event, model, option, index)) {
+      return false;
+    }
+
+    if (index.data(Qt::CheckStateRole) != before) {
+      m_Tree->onTreeCheckStateChanged(static_cast<ArchiveTreeWidgetItem*>(m_Tree->itemFromIndex(index)));
+    }
+
+    return true;
+  }
+
+private:
+  ArchiveTreeWidget* m_Tree;
+};
+
+ArchiveTreeWidget::ArchiveTreeWidget(QWidget *parent) : QTreeWidget(parent),
+  m_Updates(this, [this](UpdateChannel::Batch& batch) { applyUpdates(batch); }, [](Update& update, Update&& next) {
+    update.listing = update.listing || next.listing;
+    if (next.counts) {
+      update.counts = std::move(next.counts);
+      update.countSequence = next.countSequence;
+    }
+  })
+{
+  setItemDelegate(new CheckStateDelegate(this));
+
+  // the keys are the items themselves
+  m_SubtreeCache = m_Budget.addCache("subtrees", [this](MemoryBudget::Key key) {
+    return evictSubtree(static_cast<ArchiveTreeWidgetItem*>(const_cast<void*>(key)));
+  });
+  m_ListingCache = m_Budget.addCache("listings", [this](MemoryBudget::Key key) {
+    return evictListing(static_cast<ArchiveTreeWidgetItem*>(const_cast<void*>(key)));
+  });
+
+  // this must be the first connection so that the generation is updated before
+  // anyone is notified
+  connect(this, &ArchiveTreeWidget::treeChanged, [this] {
+    ++m_Generation;
+    m_Edits.advance();
+  });
+
+  setAutoExpandDelay(1000);
+  setDragDropOverwriteMode(true);
+  connect(this, &ArchiveTreeWidget::itemExpanded, this, &ArchiveTreeWidget::populateItem);
+  connect(this, &ArchiveTreeWidget::itemDoubleClicked, [this](QTreeWidgetItem* item) {
+    auto* placeholder = static_cast<ArchiveTreeWidgetItem*>(item);
+    if (placeholder->isPlaceholder()) {
+      showPending(placeholder, pageSize());
+    }
+  });
+
+  // start preparing the children of a hovered directory well before the
+  // auto-expand delay
+  m_HoverTimer.setSingleShot(true);
+  m_HoverTimer.setInterval(autoExpandDelay() / 4);
+  connect(&m_HoverTimer, &QTimer::timeout, this, &ArchiveTreeWidget::startPrefetch);
+
+  // counts are updated shortly after the last change, and the text of directories
+  // changes when they are expanded or collapsed
+  m_CountTimer.setSingleShot(true);
+  m_CountTimer.setInterval(100);
+  connect(&m_CountTimer, &QTimer::timeout, this, &ArchiveTreeWidget::startDirectoryCounts);
+  connect(this, &ArchiveTreeWidget::treeChanged, [this] {
+    if (m_CountDirectories) {
+      m_CountTimer.start();
+    }
+  });
+  connect(this, &ArchiveTreeWidget::itemCollapsed, [this](QTreeWidgetItem* item) {
+    decorateItem(static_cast<ArchiveTreeWidgetItem*>(item));
+  });
+}
+
+ArchiveTreeWidget::~ArchiveTreeWidget()
+{
+  discardPrefetch();
+  discardDirectoryCounts();
+
+  // the workers notify this widget, so they must be done before it is destroyed,
+  // the listings themselves are deleted with their items
+  for (auto* item : m_Listings) {
+    item->m_Listing.wait();
+    item->m_ListingWidget = nullptr;
+  }
+  m_Listings.clear();
+
+  // the items that are still alive must not notify the budget anymore
+  for (int cache : { m_SubtreeCache, m_ListingCache }) {
+    for (auto key : m_Budget.keys(cache)) {
+      static_cast<ArchiveTreeWidgetItem*>(const_cast<void*>(key))->m_Budget = nullptr;
+    }
+  }
+}
+
+std::size_t ArchiveTreeWidget::releaseContent()
+{
+  if (m_ViewRoot == nullptr) {
+    return 0;
+  }
+
+  discardPrefetch();
+  discardDirectoryCounts();
+  m_CountTimer.stop();
+  m_CountDirectories = false;
+  m_SizeOf = {};
+
+  // pending listings are applied before their items are deleted
+  for (auto* item : m_Listings) {
+    item->m_Listing.wait();
+  }
+  m_Updates.flush();
+
+  // the original root is the top-most ancestor of the data root
+  ArchiveTreeWidgetItem* outside = m_DataRoot;
+  while (outside != nullptr && outside->parent() != nullptr) {
+    outside = outside->parent();
+  }
+
+  std::function<std::size_t(QTreeWidgetItem*)> count = [&count](QTreeWidgetItem* item) {
+    std::size_t n = 1;
+    for (int i = 0; i < item->childCount(); ++i) {
+      n += count(item->child(i));
+    }
+    return n;
+  };
+  const std::size_t items = count(m_ViewRoot) + (outside != nullptr ? count(outside) : 0);
+
+  clear();
+  delete outside;
+  m_ViewRoot = nullptr;
+  m_DataRoot = nullptr;
+
+  m_SnapshotBuilder = FileTreeSnapshotBuilder();
+  m_Touched.clear();
+  m_OriginalTree.reset();
+
+  return items;
+}
+
+void ArchiveTreeWidget::setup(QString dataFolderName)
+{
+  m_ViewRoot = new ArchiveTreeWidgetItem("<" + dataFolderName + ">");
+  m_DataRoot = nullptr;
+  addTopLevelItem(m_ViewRoot);
+}
+
+void ArchiveTreeWidget::populateItem(QTreeWidgetItem* treeItem)
+{
+  auto* item = static_cast<ArchiveTreeWidgetItem*>(treeItem);
+  if (item->isNestedArchive()) {
+    m_Budget.touch(m_ListingCache, item);
+    startListing(item);
+    return;
+  }
+
+  const bool populated = item->isPopulated();
+  item->populate();
+
+  // the items of expanded directories are kept until the budget is exceeded
+  if (!populated) {
+    trackSubtree(item);
+    m_Budget.enforce();
+  }
+  else {
+    m_Budget.touch(m_SubtreeCache, item);
+  }
+
+  // the expanded directory shows its name only, its children show their counts
+  decorateItem(item);
+  for (int i = 0; i < item->childCount(); ++i) {
+    decorateItem(item->child(i));
+  }
+}
+
+void ArchiveTreeWidget::trackSubtree(ArchiveTreeWidgetItem* item)
+{
+  item->m_Budget = &m_Budget;
+  item->m_BudgetCache = m_SubtreeCache;
+  m_Budget.track(m_SubtreeCache, item, childrenBytes(item, false), item->childCount());
+}
+
+void ArchiveTreeWidget::populateAll(ArchiveTreeWidgetItem* item)
+{
+  if (!item->isDirectory()) {
+    return;
+  }
+  item->populate();
+  for (int i = 0; i < item->childCount(); ++i) {
+    populateAll(item->child(i));
+  }
+}
+
+void ArchiveTreeWidget::setDepopulateCollapsed(bool depopulate)
+{
+  disconnect(m_DepopulateConnection);
+  if (depopulate) {
+    m_DepopulateConnection = connect(this, &ArchiveTreeWidget::itemCollapsed, this, &ArchiveTreeWidget::depopulateItem);
+  }
+}
+
+void ArchiveTreeWidget::setPaging(std::size_t threshold, std::size_t pageSize)
+{
+  m_PageThreshold = threshold;
+  m_PageSize = std::max<std::size_t>(pageSize, 1);
+}
+
+std::size_t ArchiveTreeWidget::pageLimit(std::size_t count) const
+{
+  return ::pageLimit(count, m_PageThreshold, m_PageSize);
+}
+
+void ArchiveTreeWidget::showPending(ArchiveTreeWidgetItem* placeholder, std::size_t count)
+{
+  auto* parent = placeholder->parent();
+  auto& pending = placeholder->m_Pending;
+  count = std::min(count, pending.size());
+
+  // the pending entries are in the same state as the placeholder, so they are
+  // already attached or detached as they should be
+  QList<QTreeWidgetItem*> items;
+  items.reserve(static_cast<int>(count));
+  const QString prefix = childPathPrefix(*static_cast<ArchiveTreeWidgetItem*>(parent)->entry());
+  for (std::size_t i = 0; i < count; ++i) {
+    auto* newItem = new ArchiveTreeWidgetItem(pending[i]);
+    newItem->setCheckState(0, placeholder->checkState(0));
+    newItem->setToolTip(0, prefix + pending[i]->name());
+    items.append(newItem);
+  }
+  pending.erase(pending.begin(), pending.begin() + count);
+
+  parent->insertChildren(parent->indexOfChild(placeholder), items);
+  for (auto* item : items) {
+    decorateItem(static_cast<ArchiveTreeWidgetItem*>(item));
+  }
+
+  if (pending.empty()) {
+    delete parent->takeChild(parent->indexOfChild(placeholder));
+  }
+  else {
+    placeholder->updatePlaceholder();
+  }
+}
+
+void ArchiveTreeWidget::depopulateItem(QTreeWidgetItem* treeItem)
+{
+  auto* item = static_cast<ArchiveTreeWidgetItem*>(treeItem);
+
+  // only fully checked items can be depopulated: the entries of unchecked items
+  // are detached and only kept alive by their widget item, while the entries of
+  // checked items are all in the tree and can be re-populated from there
+  if (item == m_ViewRoot || !item->isPopulated() || !item->isDirectory()
+    || item->checkState(0) != Qt::Checked) {
+    return;
+  }
+
+  // the prepared children could belong to an item under this one
+  for (auto* p = m_Prefetch.item; p != nullptr; p = p->parent()) {
+    if (p == item) {
+      discardPrefetch();
+      break;
+    }
+  }
+
+  qDeleteAll(item->takeChildren());
+  item->m_Populated = false;
+  m_Budget.forget(m_SubtreeCache, item);
+  item->m_Budget = nullptr;
+}
+
+void ArchiveTreeWidget::setMemoryBudget(std::uint64_t bytes)
+{
+  m_Budget.setBudget(bytes);
+  m_Budget.enforce();
+}
+
+bool ArchiveTreeWidget::evictSubtree(ArchiveTreeWidgetItem* item)
+{
+  // visible items are kept, and the items of the data root and its ancestors hold
+  // the content of the view
+  if (item->isExpanded()) {
+    return false;
+  }
+  for (auto* p = m_DataRoot; p != nullptr; p = p->parent()) {
+    if (p == item) {
+      return false;
+    }
+  }
+
+  depopulateItem(item);
+  return !item->isPopulated();
+}
+
+bool ArchiveTreeWidget::evictListing(ArchiveTreeWidgetItem* item)
+{
+  if (item->isExpanded()) {
+    return false;
+  }
+
+  // the archive is listed again when expanded
+  qDeleteAll(item->takeChildren());
+  item->m_ListingStarted = false;
+  item->m_Budget = nullptr;
+  return true;
+}
+
+void ArchiveTreeWidget::setDirectoryCounts(bool enabled, DirectoryCounts::SizeFunction sizeOf)
+{
+  discardDirectoryCounts();
+  m_CountDirectories = enabled;
+  m_SizeOf = std::move(sizeOf);
+  m_Counts = nullptr;
+
+  if (enabled) {
+    startDirectoryCounts();
+  }
+  else {
+    m_CountTimer.stop();
+    if (m_ViewRoot != nullptr) {
+      decorateAll(m_ViewRoot);
+    }
+  }
+}
+
+void ArchiveTreeWidget::startDirectoryCounts()
+{
+  if (!m_CountDirectories) {
+    return;
+  }
+
+  // only one task at a time, the counts are started again when it finishes, a task
+  // that is done but not applied yet is outdated and is dropped
+  if (m_CountFuture.valid() && m_CountFuture.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+    m_CountOutdated = true;
+    return;
+  }
+
+  // the task does not compute anything if the tree is modified before it starts,
+  // but it still posts an update so that the counts are started again once it is
+  // done (the scheduler would skip it silently)
+  m_CountOutdated = false;
+  m_CountFuture = m_Scheduler.submit("directoryCounts", TaskScheduler::Priority::BACKGROUND,
+    [this, snapshot = snapshot(), sizeOf = m_SizeOf, previous = m_Counts, sequence = ++m_CountSequence,
+     token = editToken()]() {
+    Update update;
+    if (token.cancelled()) {
+      update.countsSkipped = true;
+    }
+    else {
+      update.counts = DirectoryCounts::compute(snapshot, sizeOf, previous);
+    }
+    update.countSequence = sequence;
+    m_Updates.post(nullptr, std::move(update));
+    return true;
+  });
+}
+
+void ArchiveTreeWidget::discardDirectoryCounts()
+{
+  if (m_CountFuture.valid()) {
+    m_CountFuture.get();
+  }
+  m_CountOutdated = false;
+
+  // counts that are still in the channel are dropped
+  ++m_CountSequence;
+}
+
+void ArchiveTreeWidget::applyDirectoryCounts(std::shared_ptr<const DirectoryCounts> counts, std::uint64_t sequence)
+{
+  // the counts may have been discarded since the task finished, or a new task may
+  // have been started after this one
+  if (sequence != m_CountSequence) {
+    return;
+  }
+
+  if (counts) {
+    m_Counts = std::move(counts);
+    decorateAll(m_ViewRoot);
+  }
+
+  // the task posts its counts right before finishing
+  if (m_CountOutdated) {
+    m_CountFuture.wait();
+    startDirectoryCounts();
+  }
+}
+
+void ArchiveTreeWidget::applyUpdates(UpdateChannel::Batch& batch)
+{
+  // all the rows are updated with a single repaint
+  setUpdatesEnabled(false);
+  for (auto& [item, update] : batch) {
+    if (update.counts || update.countsSkipped) {
+      applyDirectoryCounts(std::move(update.counts), update.countSequence);
+    }
+    if (update.listing) {
+      applyListing(item);
+    }
+  }
+  setUpdatesEnabled(true);
+}
+
+void ArchiveTreeWidget::decorateItem(ArchiveTreeWidgetItem* item)
+{
+  if (item == m_ViewRoot || !item->isDirectory()) {
+    return;
+  }
+
+  QString text = item->entry()->name();
+
+  // unchecked directories are not in the snapshot
+  const auto* count = m_CountDirectories && m_Counts && !item->isExpanded() ?
+    m_Counts->find(item->entry().get()) : nullptr;
+  if (count != nullptr) {
+    const QLocale locale;
+    const QString files = locale.toString(static_cast<qulonglong>(count->files));
+    text = m_Counts->hasSizes() ?
+      tr("%1 (%2 files, %3)").arg(text).arg(files).arg(locale.formattedDataSize(static_cast<qint64>(count->bytes))) :
+      tr("%1 (%2 files)").arg(text).arg(files);
+  }
+
+  if (item->text(0) != text) {
+    item->setText(0, text);
+  }
+}
+
+void ArchiveTreeWidget::decorateAll(ArchiveTreeWidgetItem* item)
+{
+  decorateItem(item);
+  if (item->isPopulated()) {
+    for (int i = 0; i < item->childCount(); ++i) {
+      decorateAll(item->child(i));
+    }
+  }
+}
+
+void ArchiveTreeWidget::setArchiveSource(std::shared_ptr<const ArchiveSource> source)
+{
+  m_Source = std::move(source);
+}
+
+void ArchiveTreeWidget::setOriginalTree(std::shared_ptr<const FlatFileTree> tree)
+{
+  m_OriginalTree = std::move(tree);
+}
+
+void ArchiveTreeWidget::startListing(ArchiveTreeWidgetItem* item)
+{
+  if (item->m_ListingStarted) {
+    return;
+  }
+  item->m_ListingStarted = true;
+
+  auto* loading = new ArchiveTreeWidgetItem(tr("Loading..."), false, 0);
+  loading->setToolTip(0, {});
+  item->addChild(loading);
+
+  // the entry cannot be accessed from the worker, and the source is indexed by the
+  // original paths, not by the current path of the entry
+  QString path;
+  if (m_OriginalTree) {
+    if (auto index = m_OriginalTree->find(item->entry().get()); index != FlatFileTree::NO_INDEX) {
+      path = m_OriginalTree->path(index);
+    }
+  }
+  const QString name = item->entry()->name();
+
+  item->m_ListingWidget = this;
+  m_Listings.insert(item);
+  item->m_Listing = m_Scheduler.submit("listing", TaskScheduler::Priority::INTERACTIVE, [this, listed = item, source = m_Source, path, name]() {
+    std::vector<ArchiveTreeWidgetItem*> items;
+
+    auto device = source && !path.isEmpty() ? source->open(path) : nullptr;
+    auto files = device ? NestedArchive::list(*device, name) : std::nullopt;
+    if (!files) {
+      auto* item = new ArchiveTreeWidgetItem(tr("(cannot be listed without extracting it)"), false, 0);
+      item->setToolTip(0, {});
+      items.push_back(item);
+    }
+    else {
+      // the files are sorted, so directories are created in order the first time
+      // a file under them is found
+      std::map<QString, ArchiveTreeWidgetItem*> directories;
+      for (auto& file : *files) {
+        ArchiveTreeWidgetItem* parent = nullptr;
+        int start = 0;
+        for (int separator = file.path.indexOf('/'); separator >= 0; separator = file.path.indexOf('/', start)) {
+          auto& directory = directories[file.path.left(separator).toLower()];
+          if (directory == nullptr) {
+            directory = new ArchiveTreeWidgetItem(file.path.mid(start, separator - start), true, 0);
+            if (parent != nullptr) {
+              parent->addChild(directory);
+            }
+            else {
+              items.push_back(directory);
+            }
+          }
+          parent = directory;
+          start = separator + 1;
+        }
+
+        // entries for directories only create the directory
+        if (start == file.path.size()) {
+          continue;
+        }
+
+        auto* child = new ArchiveTreeWidgetItem(file.path.mid(start), false, file.size);
+        if (parent != nullptr) {
+          parent->addChild(child);
+        }
+        else {
+          items.push_back(child);
+        }
+      }
+    }
+
+    Update update;
+    update.listing = true;
+    m_Updates.post(listed, std::move(update));
+    return items;
+  });
+}
+
+void ArchiveTreeWidget::applyListing(ArchiveTreeWidgetItem* item)
+{
+  // the item may have been deleted since the listing was read
+  auto it = m_Listings.find(item);
+  if (it == m_Listings.end()) {
+    return;
+  }
+
+  // the task posts the update right before returning the listing, and listings
+  // are never cancelled
+  auto items = item->m_Listing.get().value_or(std::vector<ArchiveTreeWidgetItem*>{});
+  qDeleteAll(item->takeChildren());
+  item->addChildren(QList<QTreeWidgetItem*>(items.begin(), items.end()));
+
+  item->m_ListingWidget = nullptr;
+  m_Listings.erase(it);
+
+  // listings are read again from the archive if evicted, which is expensive
+  constexpr double LISTING_COST = 10;
+  item->m_Budget = &m_Budget;
+  item->m_BudgetCache = m_ListingCache;
+  const auto bytes = childrenBytes(item, true);
+  m_Budget.track(m_ListingCache, item, bytes, LISTING_COST * static_cast<double>(bytes) / ITEM_BYTES);
+  m_Budget.enforce();
+}
+
+void ArchiveTreeWidget::startPrefetch()
+{
+  auto* item = m_HoverItem;
+  if (item == nullptr || item->isPopulated() || item == m_Prefetch.item) {
+    return;
+  }
+
+  discardPrefetch();
+
+  m_Prefetch.item = item;
+  m_Prefetch.generation = m_Generation;
+  m_Prefetch.children = m_Scheduler.submit("prefetch", TaskScheduler::Priority::INTERACTIVE,
+    [entry = item->entry(), threshold = m_PageThreshold, pageSize = m_PageSize]() {
+    std::vector<ArchiveTreeWidgetItem*> children;
+    auto tree = entry->astree();
+    const std::size_t shown = ::pageLimit(tree->size(), threshold, pageSize);
+    children.reserve(shown);
+    const auto end = std::next(tree->begin(), shown);
+    for (auto it = tree->begin(); it != end; ++it) {
+      children.push_back(new ArchiveTreeWidgetItem(*it));
+    }
+    return children;
+  }, editToken());
+}
+
+void ArchiveTreeWidget::waitPrefetch()
+{
+  m_HoverTimer.stop();
+  m_HoverItem = nullptr;
+  if (m_Prefetch.children.valid()) {
+    m_Prefetch.children.wait();
+  }
+}
+
+void ArchiveTreeWidget::discardPrefetch()
+{
+  if (m_Prefetch.children.valid()) {
+    if (auto children = m_Prefetch.children.get()) {
+      qDeleteAll(*children);
+    }
+  }
+  m_Prefetch.item = nullptr;
+}
+
+std::optional<std::vector<ArchiveTreeWidgetItem*>> ArchiveTreeWidget::takePrefetched(ArchiveTreeWidgetItem* item)
+{
+  if (item != m_Prefetch.item || !m_Prefetch.children.valid()) {
+    return {};
+  }
+
+  // the entries may have changed since the preparation started, the preparation
+  // is skipped if they changed before it started
+  if (m_Prefetch.generation != m_Generation) {
+    discardPrefetch();
+    return {};
+  }
+
+  m_Prefetch.item = nullptr;
+  return m_Prefetch.children.get();
+}
+
+void ArchiveTreeWidget::setDataRoot(ArchiveTreeWidgetItem* const root)
+{
+  if (root != m_DataRoot) {
+    if (m_DataRoot != nullptr) {
+      m_DataRoot->addChildren(m_ViewRoot->takeChildren());
+    }
+
+    // Force populate:
+    root->populate();
+
+    m_DataRoot = root;
+    m_ViewRoot->setEntry(m_DataRoot->entry());
+    m_ViewRoot->addChildren(m_DataRoot->takeChildren());
+    m_ViewRoot->setExpanded(true);
+
+    DataRootDelta delta;
+    delta.reset = true;
+    m_Touched.clear();
+    emit dataRootContentChanged(delta);
+    emit dataRootChanged();
+  }
+
+  emit treeChanged();
+}
+
+void ArchiveTreeWidget::forEachFile(
+  ArchiveTreeWidgetItem* item, std::function<void(const FileTreeEntry*, bool)> const& callback) const
+{
+  // the view root is not checkable, placeholders are not checkable but have a state
+  const bool checked = (!item->flags().testFlag(Qt::ItemIsUserCheckable) && !item->isPlaceholder())
+    || item->checkState(0) != Qt::Unchecked;
+
+  // non-populated trees are never cleared, even when unchecked
+  std::function<void(std::shared_ptr<const FileTreeEntry>)> walk = [&](auto entry) {
+    if (entry->isDir()) {
+      for (auto& child : *entry->astree()) {
+        walk(child);
+      }
+    }
+    else {
+      callback(entry.get(), checked);
+    }
+  };
+
+  if (item->isPlaceholder()) {
+    for (auto& entry : item->pending()) {
+      walk(entry);
+    }
+  }
+  else if (item->entry()->isFile()) {
+    callback(item->entry().get(), checked);
+  }
+  else if (item->isPopulated()) {
+    for (int i = 0; i < item->childCount(); ++i) {
+      forEachFile(item->child(i), callback);
+    }
+  }
+  else {
+    walk(item->entry());
+  }
+}
+
+void ArchiveTreeWidget::forEachSelected(std::function<bool(ArchiveTreeWidgetItem*)> const& callback) const
 {
-  if (entry->isDir()) {
-    setChildIndicatorPolicy(QTreeWidgetItem::ShowIndicator);
-    setFlags(flags() | Qt::ItemIsUserCheckable | Qt::ItemIsAutoTristate);
-  }
-  else {
-    setFlags(flags() | Qt::ItemIsUserCheckable | Qt::ItemNeverHasChildren);
+  for (const QItemSelectionRange& range : selectionModel()->selection()) {
+    for (int row = range.top(); row <= range.bottom(); ++row) {
+      auto* item = static_cast<ArchiveTreeWidgetItem*>(itemFromIndex(model()->index(row, 0, range.parent())));
+      if (item != nullptr && !callback(item)) {
+        return;
+      }
+    }
   }
-  setCheckState(0, Qt::Checked);
-  setToolTip(0, entry->path());
 }
 
-void ArchiveTreeWidgetItem::setData(int column, int role, const QVariant& value)
+std::vector<ArchiveTreeWidget::SelectionRange> ArchiveTreeWidget::selectionRanges() const
 {
-  ArchiveTreeWidget* tree = static_cast<ArchiveTreeWidget*>(treeWidget());
-  if (tree != nullptr && tree->m_Emitter == nullptr) {
-    tree->m_Emitter = this;
+  std::vector<SelectionRange> ranges;
+  for (const QItemSelectionRange& range : selectionModel()->selection()) {
+    ranges.push_back({
+      static_cast<ArchiveTreeWidgetItem*>(itemFromIndex(range.parent())), range.top(), range.bottom() });
   }
-  QTreeWidgetItem::setData(column, role, value);
-  if (tree != nullptr && tree->m_Emitter == this) {
-    tree->m_Emitter = nullptr;
-    if (role == Qt::CheckStateRole) {
-      tree->onTreeCheckStateChanged(this);
+
+  // ranges in the same parent are disjoint, so removing the rows of the last
+  // range first keeps the other ranges valid
+  std::sort(ranges.begin(), ranges.end(), [](auto const& lhs, auto const& rhs) {
+    return lhs.parent != rhs.parent ? lhs.parent < rhs.parent : lhs.top > rhs.top;
+  });
+
+  return ranges;
+}
+
+void ArchiveTreeWidget::setSelectedCheckState(Qt::CheckState state)
+{
+  m_BatchUpdate = true;
+  forEachSelected([this, state](ArchiveTreeWidgetItem* item) {
+    if (item->flags().testFlag(Qt::ItemIsUserCheckable) && item->checkState(0) != state) {
+      setItemCheckState(item, state);
     }
-  }
+    return true;
+  });
+  m_BatchUpdate = false;
+
+  emit treeChanged();
 }
 
-void ArchiveTreeWidgetItem::populate(bool force) {
+std::shared_ptr<const FlatFileTree> ArchiveTreeWidget::currentImage(
+  ArchiveTreeWidgetItem* item, FlatFileTree::SizeFunction sizeOf) const
+{
+  StallWatchdog::Scope scope("image", item->entry()->path());
+
+  // the children of populated directories are the ones of their items since
+  // unchecked entries are detached, other directories have all their entries
+  // attached
+  std::unordered_map<const FileTreeEntry*, ArchiveTreeWidgetItem*> populated;
+  std::function<void(ArchiveTreeWidgetItem*)> collect = [&](ArchiveTreeWidgetItem* item) {
+    if (!item->isDirectory() || !item->isPopulated()) {
+      return;
+    }
+    populated[item->entry().get()] = item;
+    for (int i = 0; i < item->childCount(); ++i) {
+      collect(item->child(i));
+    }
+  };
+  collect(item);
+
+  auto children = [&populated](const FileTreeEntry* entry) {
+    std::vector<std::shared_ptr<const FileTreeEntry>> children;
+    auto it = populated.find(entry);
+    if (it == populated.end()) {
+      auto tree = entry->astree();
+      children.assign(tree->begin(), tree->end());
+      return children;
+    }
 
-  // Only populates once:
-  if (isPopulated() && !force) {
-    return;
-  }
+    auto* item = it->second;
+    for (int i = 0; i < item->childCount(); ++i) {
+      auto* child = item->child(i);
+      if (child->isPlaceholder()) {
+        children.insert(children.end(), child->pending().begin(), child->pending().end());
+      }
+      else if (child->entry() != nullptr && !child->isListed()) {
+        children.push_back(child->entry());
+      }
+    }
+    return children;
+  };
 
-  // Should never happen:
-  if (entry()->isFile()) {
-    return;
-  }
+  return FlatFileTree::build(item->entry(), children, std::move(sizeOf));
+}
+
+std::size_t ArchiveTreeWidget::selectNodes(FlatFileTree const& tree, std::vector<FlatFileTree::Index> const& nodes)
+{
+  StallWatchdog::Scope scope("select", QString("%1 nodes").arg(nodes.size()));
+  discardPrefetch();
+
+  // items of the entries, only the existing items are indexed at first, the items
+  // created along the way are indexed when their parent is populated
+  std::unordered_map<const FileTreeEntry*, ArchiveTreeWidgetItem*> items;
+  auto indexChildren = [&items](ArchiveTreeWidgetItem* item) {
+    for (int i = 0; i < item->childCount(); ++i) {
+      auto* child = item->child(i);
+      if (child->entry() != nullptr && !child->isListed()) {
+        items[child->entry().get()] = child;
+      }
+    }
+  };
+  std::function<void(ArchiveTreeWidgetItem*)> indexPopulated = [&](ArchiveTreeWidgetItem* item) {
+    indexChildren(item);
+    for (int i = 0; i < item->childCount(); ++i) {
+      if (item->child(i)->isDirectory() && item->child(i)->isPopulated()) {
+        indexPopulated(item->child(i));
+      }
+    }
+  };
+  items[m_ViewRoot->entry().get()] = m_ViewRoot;
+  indexPopulated(m_ViewRoot);
+
+  // create the item of the given entry under its parent item, the budget is only
+  // enforced at the next expansion so that none of the indexed items is deleted
+  auto createItem = [&](ArchiveTreeWidgetItem* parent, const FileTreeEntry* entry) -> ArchiveTreeWidgetItem* {
+    if (!parent->isDirectory()) {
+      return nullptr;
+    }
+    if (!parent->isPopulated()) {
+      parent->populate();
+      trackSubtree(parent);
+      for (int i = 0; i < parent->childCount(); ++i) {
+        decorateItem(parent->child(i));
+      }
+    }
+
+    // the entry may be pending in the placeholder of a paged directory
+    auto* last = parent->childCount() > 0 ? parent->child(parent->childCount() - 1) : nullptr;
+    if (last != nullptr && last->isPlaceholder()) {
+      auto& pending = last->pending();
+      auto it = std::find_if(pending.begin(), pending.end(), [entry](auto const& p) { return p.get() == entry; });
+      if (it != pending.end()) {
+        showPending(last, static_cast<std::size_t>(std::distance(pending.begin(), it)) + 1);
+      }
+    }
 
-  // We go in reverse of the tree because we want to insert the original
-  // entries at the beginning (the item can only contains children if a
-  // directory has been created under it or if entries has been moved under
-  // it):
-  for (auto &entry: *entry()->astree()) {
-    auto newItem = new ArchiveTreeWidgetItem(entry);
-    newItem->setCheckState(0, flags().testFlag(Qt::ItemIsUserCheckable) ? checkState(0) : Qt::Checked);
-    addChild(newItem);
+    indexChildren(parent);
+    auto it = items.find(entry);
+    return it != items.end() ? it->second : nullptr;
+  };
+
+  // the items to select, grouped by parent so that contiguous rows are selected
+  // as a single range
+  std::unordered_map<ArchiveTreeWidgetItem*, std::unordered_set<ArchiveTreeWidgetItem*>> selected;
+  std::vector<const FileTreeEntry*> chain;
+  for (auto node : nodes) {
+
+    // walk up the image to the closest node with an item, nodes that are not under
+    // the data root never reach one
+    chain.clear();
+    auto it = items.find(tree.key(node));
+    for (auto current = node; it == items.end() && current != FlatFileTree::NO_INDEX; ) {
+      chain.push_back(tree.key(current));
+      current = tree.parent(current);
+      it = current != FlatFileTree::NO_INDEX ? items.find(tree.key(current)) : items.end();
+    }
+    if (it == items.end()) {
+      continue;
+    }
+
+    // and create the items down to the node
+    auto* item = it->second;
+    for (auto c = chain.rbegin(); c != chain.rend() && item != nullptr; ++c) {
+      item = createItem(item, *c);
+    }
+    if (item != nullptr && item != m_ViewRoot) {
+      selected[item->parent()].insert(item);
+    }
   }
 
-  // If the item is unchecked, we need to clear it because it has not been cleared
-  // before:
-  if (flags().testFlag(Qt::ItemIsUserCheckable) && checkState(0) == Qt::Unchecked) {
-    entry()->astree()->clear();
+  QItemSelection selection;
+  std::size_t count = 0;
+  for (auto& [parent, children] : selected) {
+    int top = -1;
+    for (int row = 0; row <= parent->childCount(); ++row) {
+      const bool in = row < parent->childCount() && children.count(parent->child(row)) > 0;
+      if (in && top < 0) {
+        top = row;
+      }
+      else if (!in && top >= 0) {
+        selection.append(QItemSelectionRange(indexFromItem(parent->child(top)), indexFromItem(parent->child(row - 1))));
+        top = -1;
+      }
+    }
+    count += children.size();
   }
+  selectionModel()->select(selection, QItemSelectionModel::ClearAndSelect | QItemSelectionModel::Rows);
 
-  m_Populated = true;
+  return count;
 }
 
-ArchiveTreeWidget::ArchiveTreeWidget(QWidget *parent) : QTreeWidget(parent)
+std::vector<const FileTreeEntry*> ArchiveTreeWidget::selectedEntries() const
 {
-  setAutoExpandDelay(1000);
-  setDragDropOverwriteMode(true);
-  connect(this, &ArchiveTreeWidget::itemExpanded, this, &ArchiveTreeWidget::populateItem);
+  std::vector<const FileTreeEntry*> entries;
+  forEachSelected([&entries](ArchiveTreeWidgetItem* item) {
+    if (item->entry() != nullptr && !item->isListed()) {
+      entries.push_back(item->entry().get());
+    }
+    return true;
+  });
+  return entries;
 }
 
-void ArchiveTreeWidget::setup(QString dataFolderName)
+std::shared_ptr<const FileTreeSnapshot> ArchiveTreeWidget::snapshot()
 {
-  m_ViewRoot = new ArchiveTreeWidgetItem("<" + dataFolderName + ">");
-  m_DataRoot = nullptr;
-  addTopLevelItem(m_ViewRoot);
+  return m_SnapshotBuilder.build(m_ViewRoot->entry()->astree(), m_Generation);
 }
 
-void ArchiveTreeWidget::populateItem(QTreeWidgetItem* item)
+void ArchiveTreeWidget::invalidateSnapshot(ArchiveTreeWidgetItem* item, bool recursive)
 {
-  static_cast<ArchiveTreeWidgetItem*>(item)->populate();
+  if (item->entry() != nullptr) {
+    m_SnapshotBuilder.invalidate(item->entry().get(), recursive);
+  }
+  for (auto* parent = item->parent(); parent != nullptr; parent = parent->parent()) {
+    if (parent->entry() != nullptr) {
+      m_SnapshotBuilder.invalidate(parent->entry().get());
+    }
+  }
 }
 
-void ArchiveTreeWidget::setDataRoot(ArchiveTreeWidgetItem* const root)
+void ArchiveTreeWidget::touchDataRoot(QString const& name)
 {
-  if (root != m_DataRoot) {
-    if (m_DataRoot != nullptr) {
-      m_DataRoot->addChildren(m_ViewRoot->takeChildren());
-    }
+  m_Touched.try_emplace(name, m_ViewRoot->entry()->astree()->exists(name));
+}
 
-    // Force populate:
-    root->populate();
+void ArchiveTreeWidget::touchDataRoot(ArchiveTreeWidgetItem* item)
+{
+  if (item == m_ViewRoot) {
+    return;
+  }
+  while (item->parent() != nullptr && item->parent() != m_ViewRoot) {
+    item = item->parent();
+  }
+  if (item->parent() == m_ViewRoot) {
+    touchDataRoot(item->entry()->name());
+  }
+}
 
-    m_DataRoot = root;
-    m_ViewRoot->setEntry(m_DataRoot->entry());
-    m_ViewRoot->addChildren(m_DataRoot->takeChildren());
-    m_ViewRoot->setExpanded(true);
+void ArchiveTreeWidget::emitDataRootDelta()
+{
+  auto tree = m_ViewRoot->entry()->astree();
+
+  DataRootDelta delta;
+  for (auto& [name, existed] : m_Touched) {
+    const bool exists = tree->exists(name);
+    if (existed && exists) {
+      delta.modify(name);
+    }
+    else if (existed) {
+      delta.remove(name);
+    }
+    else if (exists) {
+      delta.add(name);
+    }
   }
+  m_Touched.clear();
 
-  emit treeChanged();
+  if (!delta.empty()) {
+    emit dataRootContentChanged(delta);
+  }
 }
 
 void ArchiveTreeWidget::detachParents(ArchiveTreeWidgetItem* item) {
@@ -198,6 +1240,12 @@ void ArchiveTreeWidget::recursiveInsert(ArchiveTreeWidgetItem* item) {
     auto tree = item->entry()->astree();
     for (int i = 0; i < item->childCount(); ++i) {
       auto child = static_cast<ArchiveTreeWidgetItem*>(item->child(i));
+      if (child->isPlaceholder()) {
+        for (auto& entry : child->pending()) {
+          tree->insert(entry);
+        }
+        continue;
+      }
       tree->insert(child->entry());
       if (child->entry()->isDir()) {
         recursiveInsert(child);
@@ -210,7 +1258,7 @@ void ArchiveTreeWidget::recursiveDetach(ArchiveTreeWidgetItem* item) {
   if (item->isPopulated()) {
     for (int i = 0; i < item->childCount(); ++i) {
       auto child = static_cast<ArchiveTreeWidgetItem*>(item->child(i));
-      if (child->entry()->isDir()) {
+      if (!child->isPlaceholder() && child->entry()->isDir()) {
         recursiveDetach(child);
       }
     }
@@ -220,19 +1268,38 @@ void ArchiveTreeWidget::recursiveDetach(ArchiveTreeWidgetItem* item) {
 
 ArchiveTreeWidgetItem* ArchiveTreeWidget::addDirectory(ArchiveTreeWidgetItem* item, QString name)
 {
+  if (item == m_ViewRoot) {
+    touchDataRoot(name);
+  }
+  else {
+    touchDataRoot(item);
+  }
+
   auto tree = item->entry()->astree();
   auto* newItem = new ArchiveTreeWidgetItem(tree->addDirectory(name));
+  newItem->setToolTip(0, newItem->entry()->path());
 
   // find the insert position
   auto it = std::find_if(tree->begin(), tree->end(), [name](auto&& entry) {
     return entry->compare(name) == 0;
   });
   int index = it - tree->begin();
+
+  // the directory may be among the pending entries of a paged directory, in which
+  // case it is shown before the placeholder
+  int shown = item->childCount();
+  if (shown > 0 && item->child(shown - 1)->isPlaceholder()) {
+    --shown;
+  }
+  index = std::min(index, shown);
+
   MOBase::log::debug("insert at: {}", index);
   item->insertChild(index, newItem);
 
-  newItem->setCheckState(0, Qt::Checked);
+  setItemCheckState(newItem, Qt::Checked);
   attachParents(item);
+  invalidateSnapshot(item, false);
+  emitDataRootDelta();
   emit treeChanged();
 
   return newItem;
@@ -248,13 +1315,16 @@ void ArchiveTreeWidget::moveItem(ArchiveTreeWidgetItem* source, ArchiveTreeWidge
   // in the tree widget to find unchecked items
   for (int i = 0; i < target->childCount(); ++i) {
     auto* child = target->child(i);
+    if (child->isPlaceholder()) {
+      continue;
+    }
     if (child->entry()->compare(source->entry()->name()) == 0) {
       // remove existing file and force check existing directory
       if (child->entry()->isFile()) {
         target->removeChild(child);
       }
       else {
-        child->setCheckState(0, Qt::Checked);
+        setItemCheckState(child, Qt::Checked);
       }
       break;
     }
@@ -263,14 +1333,23 @@ void ArchiveTreeWidget::moveItem(ArchiveTreeWidgetItem* source, ArchiveTreeWidge
   tree->insert(source->entry(), IFileTree::InsertPolicy::MERGE);
 
   attachParents(target);
+}
 
-  emit treeChanged();
+void ArchiveTreeWidget::setItemCheckState(ArchiveTreeWidgetItem* item, Qt::CheckState state)
+{
+  item->setCheckState(0, state);
+  onTreeCheckStateChanged(item);
 }
 
 void ArchiveTreeWidget::onTreeCheckStateChanged(ArchiveTreeWidgetItem* item) {
 
   auto entry = item->entry();
 
+  touchDataRoot(item);
+
+  // detaching or re-attaching modifies the whole subtree
+  invalidateSnapshot(item, true);
+
   // If the entry is a directory, we need to either detach or re-attach all the
   // children. It is not possible to only detach the directory because if the
   // user uncheck a directory and then check a file under it, the other files would
@@ -301,7 +1380,11 @@ void ArchiveTreeWidget::onTreeCheckStateChanged(ArchiveTreeWidgetItem* item) {
     attachParents(item);
   }
 
-  emit treeChanged();
+  emitDataRootDelta();
+  emit checkStateChanged(item);
+  if (!m_BatchUpdate) {
+    emit treeChanged();
+  }
 }
 
 bool ArchiveTreeWidget::testMovePossible(ArchiveTreeWidgetItem* source, ArchiveTreeWidgetItem* target)
@@ -310,7 +1393,7 @@ bool ArchiveTreeWidget::testMovePossible(ArchiveTreeWidgetItem* source, ArchiveT
     return false;
   }
 
-  if (target->flags().testFlag(Qt::ItemNeverHasChildren)) {
+  if (!target->isDirectory()) {
     return false;
   }
 
@@ -336,13 +1419,31 @@ void ArchiveTreeWidget::dragEnterEvent(QDragEnterEvent *event)
 
 void ArchiveTreeWidget::dragMoveEvent(QDragMoveEvent *event)
 {
-  if (!testMovePossible(
-    static_cast<ArchiveTreeWidgetItem*>(currentItem()),
-    static_cast<ArchiveTreeWidgetItem*>(itemAt(event->pos())))) {
+  auto* target = static_cast<ArchiveTreeWidgetItem*>(itemAt(event->pos()));
+  if (!testMovePossible(static_cast<ArchiveTreeWidgetItem*>(currentItem()), target)) {
     event->ignore();
   } else {
     QTreeWidget::dragMoveEvent(event);
   }
+
+  // restart the hover timer when the hovered directory changes
+  if (target != m_HoverItem) {
+    m_HoverItem = target;
+    if (target != nullptr && target->isDirectory() && !target->isPopulated()) {
+      m_HoverTimer.start();
+    }
+    else {
+      m_HoverTimer.stop();
+    }
+  }
+}
+
+void ArchiveTreeWidget::dragLeaveEvent(QDragLeaveEvent* event)
+{
+  // the prepared children are kept for a later expansion, but the background
+  // thread must not run once the drag is over
+  waitPrefetch();
+  QTreeWidget::dragLeaveEvent(event);
 }
 
 static bool isAncestor(const QTreeWidgetItem *ancestor, const QTreeWidgetItem *item)
@@ -359,7 +1460,7 @@ static bool isAncestor(const QTreeWidgetItem *ancestor, const QTreeWidgetItem *i
 
 void ArchiveTreeWidget::refreshItem(ArchiveTreeWidgetItem* item)
 {
-  if (!item->isPopulated() || item->flags().testFlag(Qt::ItemNeverHasChildren)) {
+  if (!item->isPopulated() || !item->isDirectory()) {
     return;
   }
 
@@ -368,6 +1469,10 @@ void ArchiveTreeWidget::refreshItem(ArchiveTreeWidgetItem* item)
   std::map<QString, bool, MOBase::FileNameComparator> expanded;
   while (item->childCount() > 0) {
     auto* child = item->child(0);
+    if (child->isPlaceholder()) {
+      delete item->takeChild(0);
+      continue;
+    }
     expanded[child->entry()->name()] = child->isExpanded();
     item->removeChild(child);
   }
@@ -376,21 +1481,244 @@ void ArchiveTreeWidget::refreshItem(ArchiveTreeWidgetItem* item)
 
   for (int i = 0; i < item->childCount(); ++i) {
     auto* child = item->child(i);
-    if (expanded[child->entry()->name()]) {
+    if (!child->isPlaceholder() && expanded[child->entry()->name()]) {
       child->setExpanded(true);
     }
   }
 }
 
+// walk the content of the given directories in parallel, in name order, and record
+// the paths of files present in several directories with the directory the file
+// is taken from (the last one), and the paths that are a file in one directory
+// and a folder in another, folders present in several directories are walked the
+// same way
+//
+// each tree comes with the index of the merged directory it belongs to, in merge
+// order
+//
+using MergeSources = std::vector<std::pair<std::size_t, std::shared_ptr<const IFileTree>>>;
+static void findMergeConflicts(
+  MergeSources const& trees, QString const& path,
+  std::vector<std::pair<QString, std::size_t>>& replaced, QStringList& mismatched)
+{
+  // IFileTree lists folders before files, so each directory is sorted by name once
+  using Entries = std::vector<std::shared_ptr<const FileTreeEntry>>;
+  std::vector<Entries> entries;
+  entries.reserve(trees.size());
+  for (auto& [origin, tree] : trees) {
+    auto& sorted = entries.emplace_back(tree->begin(), tree->end());
+    std::sort(sorted.begin(), sorted.end(), [](auto const& lhs, auto const& rhs) {
+      return lhs->compare(rhs->name()) < 0;
+    });
+  }
+
+  std::vector<std::size_t> positions(trees.size(), 0);
+  while (true) {
+
+    // the smallest name among the current entries of all the directories
+    std::shared_ptr<const FileTreeEntry> next;
+    for (std::size_t i = 0; i < entries.size(); ++i) {
+      if (positions[i] < entries[i].size() && (!next || entries[i][positions[i]]->compare(next->name()) < 0)) {
+        next = entries[i][positions[i]];
+      }
+    }
+    if (!next) {
+      break;
+    }
+
+    MergeSources directories;
+    std::size_t files = 0, winner = 0;
+    for (std::size_t i = 0; i < entries.size(); ++i) {
+      if (positions[i] < entries[i].size() && entries[i][positions[i]]->compare(next->name()) == 0) {
+        auto& entry = entries[i][positions[i]++];
+        if (entry->isDir()) {
+          directories.emplace_back(trees[i].first, entry->astree());
+        }
+        else {
+          ++files;
+          winner = std::max(winner, trees[i].first);
+        }
+      }
+    }
+
+    const QString entryPath = path.isEmpty() ? next->name() : path + "/" + next->name();
+    if (files > 0 && !directories.empty()) {
+      mismatched.append(entryPath);
+    }
+    else if (files > 1) {
+      replaced.emplace_back(entryPath, winner);
+    }
+    else if (directories.size() > 1) {
+      findMergeConflicts(directories, entryPath, replaced, mismatched);
+    }
+  }
+}
+
+// list at most a few of the given paths, for message boxes
+//
+static QString listPaths(QStringList const& paths)
+{
+  constexpr int maxPaths = 10;
+  QString text = paths.mid(0, maxPaths).join("\n");
+  if (paths.size() > maxPaths) {
+    text += "\n" + QObject::tr("... and %1 more").arg(paths.size() - maxPaths);
+  }
+  return text;
+}
+
+bool ArchiveTreeWidget::setDataRoots(std::vector<ArchiveTreeWidgetItem*> const& roots)
+{
+  if (roots.empty()) {
+    return false;
+  }
+
+  if (roots.size() == 1) {
+    setDataRoot(roots.front());
+    return true;
+  }
+
+  for (auto* root : roots) {
+    if (root == m_ViewRoot || !root->isDirectory()) {
+      return false;
+    }
+    for (auto* other : roots) {
+      if (isAncestor(root, other)) {
+        QMessageBox::warning(parentWidget(), tr("Cannot merge"),
+          tr("Cannot merge '%1' with one of its subfolder.").arg(root->entry()->name()));
+        return false;
+      }
+    }
+  }
+
+  auto* target = roots.front();
+
+  std::vector<std::pair<QString, std::size_t>> replaced;
+  QStringList mismatched;
+  {
+    MergeSources trees;
+    for (std::size_t i = 0; i < roots.size(); ++i) {
+      trees.emplace_back(i, roots[i]->entry()->astree());
+    }
+    findMergeConflicts(trees, {}, replaced, mismatched);
+  }
+
+  if (!mismatched.isEmpty()) {
+    QMessageBox::warning(parentWidget(), tr("Cannot merge"),
+      tr("The following entries are files in some folders and folders in others:\n%1").arg(listPaths(mismatched)));
+    return false;
+  }
+
+  if (!replaced.empty()) {
+    // folders with the same name can be merged, so the full path is shown
+    QStringList kept;
+    for (auto& [path, winner] : replaced) {
+      kept.append(tr("%1 (from '%2')").arg(path).arg(roots[winner]->entry()->path("/")));
+    }
+    const auto answer = QMessageBox::question(parentWidget(), tr("Replace files?"),
+      tr("The following files exist in several folders, only the one from the given folder will be kept:\n%1\n\nContinue?")
+        .arg(listPaths(kept)));
+    if (answer != QMessageBox::Yes) {
+      return false;
+    }
+  }
+
+  StallWatchdog::Scope scope("mergeDataRoots", QString("%1 folders into '%2'")
+    .arg(roots.size()).arg(target->entry()->path()));
+
+  target->populate();
+  discardPrefetch();
+
+  // the checked content of each directory is moved into the target, unchecked items
+  // are left where they are, the data root is reset at the end so the changes to the
+  // current data root do not need to be tracked
+  m_BatchUpdate = true;
+  for (std::size_t i = 1; i < roots.size(); ++i) {
+    auto* root = roots[i];
+    moveCheckedContent(root, target);
+
+    // the directory may be empty now
+    if (root->entry()->astree()->empty()) {
+      detachParents(root);
+    }
+  }
+  attachParents(target);
+  m_BatchUpdate = false;
+
+  invalidateSnapshot(target, true);
+  refreshItem(target);
+
+  setDataRoot(target);
+  emit itemsMoved();
+
+  return true;
+}
+
+void ArchiveTreeWidget::moveCheckedContent(ArchiveTreeWidgetItem* source, ArchiveTreeWidgetItem* target)
+{
+  source->populate();
+  target->populate();
+  invalidateSnapshot(source, false);
+  invalidateSnapshot(target, false);
+
+  auto tree = target->entry()->astree();
+  for (int row = source->childCount() - 1; row >= 0; --row) {
+    auto* child = source->child(row);
+    if (child->checkState(0) == Qt::Unchecked) {
+      continue;
+    }
+
+    if (child->isPlaceholder()) {
+      for (auto& entry : child->pending()) {
+        entry->detach();
+        tree->insert(entry, IFileTree::InsertPolicy::MERGE);
+      }
+    }
+    else if (child->isDirectory() && child->checkState(0) == Qt::PartiallyChecked) {
+
+      // the folder is merged with the one of the target, but only its checked content
+      // is moved so the item is kept for the unchecked ones - the state of an existing
+      // folder is left as is so that the content the user excluded from it stays
+      // excluded, its entry is only re-attached once the content has been moved
+      ArchiveTreeWidgetItem* directory = nullptr;
+      for (int i = 0; i < target->childCount() && directory == nullptr; ++i) {
+        auto* candidate = target->child(i);
+        if (!candidate->isPlaceholder() && candidate->isDirectory()
+          && candidate->entry()->compare(child->entry()->name()) == 0) {
+          directory = candidate;
+        }
+      }
+      if (directory == nullptr) {
+        directory = new ArchiveTreeWidgetItem(tree->addDirectory(child->entry()->name()));
+        directory->setToolTip(0, directory->entry()->path());
+        target->addChild(directory);
+        directory->setCheckState(0, Qt::Checked);
+      }
+
+      moveCheckedContent(child, directory);
+      attachParents(directory);
+      if (child->entry()->astree()->empty()) {
+        detachParents(child);
+      }
+      continue;
+    }
+    else {
+      moveItem(child, target);
+    }
+    delete source->takeChild(row);
+  }
+}
+
 void ArchiveTreeWidget::dropEvent(QDropEvent *event)
 {
   event->ignore();
+  waitPrefetch();
 
   // target widget (should be a directory)
   auto *target =  static_cast<ArchiveTreeWidgetItem*>(itemAt(event->pos()));
 
-  // this should not really happen because it is prevent by dragMoveEvent
-  if (target->flags().testFlag(Qt::ItemNeverHasChildren)) {
+  // this should not really happen because it is prevent by dragMoveEvent, items
+  // listed from nested archives can be several levels below the closest directory
+  while (!target->isDirectory()) {
 
     // this should really not happen, how should a file get to the top level?
     if (target->parent() == nullptr) {
@@ -400,69 +1728,159 @@ void ArchiveTreeWidget::dropEvent(QDropEvent *event)
     target = target->parent();
   }
 
-  // populate target if required
-  target->populate();
+  if (!moveSelected(target)) {
+    event->accept();
+  }
+}
+
+bool ArchiveTreeWidget::moveSelected(ArchiveTreeWidgetItem* target)
+{
+  waitPrefetch();
+
+  StallWatchdog::Scope scope("drop", QString("into '%1', %2 selection ranges")
+    .arg(target->entry()->path()).arg(selectionModel()->selection().size()));
 
-  auto sourceItems = this->selectedItems();
+  // populate target if required, this uses the prepared children if the target
+  // was prepared, other prepared children are discarded since the tree is going
+  // to be modified
+  target->populate();
+  discardPrefetch();
 
   // check the selected items - we do not want to move only
   // some items so we check everything first and then move
-  for (auto* source : sourceItems) {
-
-    auto* aSource = static_cast<ArchiveTreeWidgetItem*>(source);
+  bool valid = true;
+  forEachSelected([&](ArchiveTreeWidgetItem* source) {
 
     // do not allow element to be dropped into one of its
     // own child
     if (isAncestor(source, target)) {
-      event->accept();
       QMessageBox::warning(parentWidget(),
         tr("Cannot drop"),
-        tr("Cannot drop '%1' into one of its subfolder.").arg(aSource->entry()->name()));
-      return;
+        tr("Cannot drop '%1' into one of its subfolder.").arg(source->entry()->name()));
+      valid = false;
+      return false;
     }
 
-    auto sourceEntry = aSource->entry();
+    auto sourceEntry = source->entry();
     auto targetEntry = target->entry()->astree()->find(sourceEntry->name());
     if (targetEntry && targetEntry->fileType() != sourceEntry->fileType()) {
-      event->accept();
       QMessageBox::warning(parentWidget(),
         tr("Cannot drop"),
         targetEntry->isFile() ?
         tr("A file '%1' already exists in folder '%2'.").arg(sourceEntry->name()).arg(target->entry()->name())
         : tr("A folder '%1' already exists in folder '%2'.").arg(sourceEntry->name()).arg(target->entry()->name()));
-      return;
+      valid = false;
+      return false;
     }
 
+    return true;
+  });
+
+  if (!valid) {
+    return false;
+  }
+
+  // names of the target children, to find the directories that are going to be
+  // merged without a linear search for each source
+  std::map<QString, ArchiveTreeWidgetItem*, MOBase::FileNameComparator> targetChildren;
+  for (int i = 0; i < target->childCount(); ++i) {
+    if (!target->child(i)->isPlaceholder()) {
+      targetChildren[target->child(i)->entry()->name()] = target->child(i);
+    }
   }
 
-  for (auto* source : sourceItems) {
+  auto move = [&](ArchiveTreeWidgetItem* source) {
+
+    // force expand item that are going to be merged
+    auto it = targetChildren.find(source->entry()->name());
+    if (it != targetChildren.end() && it->second->isDirectory()) {
+      it->second->setExpanded(true);
+    }
+
+    if (target == m_ViewRoot) {
+      touchDataRoot(source->entry()->name());
+    }
+    else {
+      touchDataRoot(target);
+    }
+
+    // actually perform the move on the underlying tree model
+    moveItem(source, target);
+
+    // the item is not used anymore since the target is refreshed
+    delete source;
+  };
+
+  // items whose ancestor is also selected are moved with the ancestor, so we
+  // skip their ranges (this must be done before anything is moved)
+  auto ranges = selectionRanges();
+  ranges.erase(std::remove_if(ranges.begin(), ranges.end(), [](auto const& range) {
+    for (auto* item = range.parent; item != nullptr; item = item->parent()) {
+      if (item->isSelected()) {
+        return true;
+      }
+    }
+    return false;
+  }), ranges.end());
 
-    auto* aSource = static_cast<ArchiveTreeWidgetItem*>(source);
+  m_BatchUpdate = true;
+  for (auto& range : ranges) {
 
-    // this only check dropping an item on itself or dropping an item in
-    // its parent so it is ok, it just does not do anything
-    if (source->parent() == nullptr || !testMovePossible(aSource, target)) {
+    // top-level items cannot be moved, and dropping an item in its parent
+    // does not do anything
+    if (range.parent == nullptr || range.parent == target) {
       continue;
     }
 
-    // force expand item that are going to be merged
-    for (int i = 0; i < target->childCount(); ++i) {
-      auto* child = target->child(i);
-      if (child->entry()->compare(aSource->entry()->name()) == 0
-        && !child->flags().testFlag(Qt::ItemNeverHasChildren)) {
-        child->setExpanded(true);
+    invalidateSnapshot(range.parent, false);
+
+    // sources taken from the data root are directly removed from it, otherwise
+    // the data root entry containing them is modified
+    if (range.parent == m_ViewRoot) {
+      for (int row = range.top; row <= range.bottom; ++row) {
+        touchDataRoot(range.parent->child(row)->entry()->name());
+      }
+    }
+    else {
+      touchDataRoot(range.parent);
+    }
+
+    // if the range covers all the children of the parent and does not contain the
+    // target itself, we can take all the children at once
+    if (range.top == 0 && range.bottom == range.parent->childCount() - 1 && target->parent() != range.parent) {
+      for (auto* child : range.parent->takeChildren()) {
+        move(static_cast<ArchiveTreeWidgetItem*>(child));
       }
+      continue;
     }
 
-    // remove the source from its parent
-    source->parent()->removeChild(source);
+    for (int row = range.bottom; row >= range.top; --row) {
+      auto* source = range.parent->child(row);
 
-    // actually perform the move on the underlying tree model
-    moveItem(aSource, target);
+      // this only check dropping an item on itself so it is ok, it just
+      // does not do anything
+      if (!testMovePossible(source, target)) {
+        continue;
+      }
+
+      // remove the source from its parent
+      range.parent->takeChild(row);
+      move(source);
+    }
   }
 
+  m_BatchUpdate = false;
+
+  // directories under the target may have been merged
+  invalidateSnapshot(target, true);
+
   // refresh the target item - this assumes that itemMoved is called synchronously
   // and perform the FileTree changes
   refreshItem(target);
 
+  emitDataRootDelta();
+  emit itemsMoved();
+  emit treeChanged();
+
+  return true;
 }
@@ -20,9 +20,25 @@ along with Mod Organizer.  If not, see <http://www.gnu.org/licenses/>.
 #ifndef ARCHIVETREE_H
 #define ARCHIVETREE_H
 
+#include <functional>
+#include <map>
+#include <future>
+#include <optional>
+#include <set>
+#include <vector>
+
+#include <QTimer>
 #include <QTreeWidget>
 
+#include "directorycounts.h"
+#include "flattree.h"
 #include "ifiletree.h"
+#include "incrementalcheck.h"
+#include "memorybudget.h"
+#include "nestedarchive.h"
+#include "resultchannel.h"
+#include "taskscheduler.h"
+#include "treesnapshot.h"
 
 class ArchiveTreeWidget;
 
@@ -35,6 +51,18 @@ public:
   ArchiveTreeWidgetItem(QString dataName);
   ArchiveTreeWidgetItem(std::shared_ptr<MOBase::FileTreeEntry> entry);
 
+  // create a placeholder item standing for the given entries, that have no item
+  // (see ArchiveTreeWidget::setPaging()), the entries all have the given state
+  //
+  ArchiveTreeWidgetItem(std::vector<std::shared_ptr<MOBase::FileTreeEntry>> pending, Qt::CheckState state);
+
+  // create an item for a file or a directory inside a nested archive, such items have
+  // no entry and cannot be checked or moved
+  //
+  ArchiveTreeWidgetItem(QString name, bool directory, std::uint64_t size);
+
+  ~ArchiveTreeWidgetItem();
+
 public:
 
   // populate this tree widget item if it has not been populated yet
@@ -46,6 +74,32 @@ public:
   //
   bool isPopulated() const { return m_Populated; }
 
+  // check if this item is a directory of the tree, as opposed to files, placeholders
+  // and the content of nested archives
+  //
+  bool isDirectory() const {
+    return !m_Placeholder && !m_Listed && m_Entry != nullptr && m_Entry->isDir();
+  }
+
+  // check if this item is a file that is an archive whose content can be listed
+  //
+  bool isNestedArchive() const { return m_Nested; }
+
+  // check if this item is part of the content of a nested archive
+  //
+  bool isListed() const { return m_Listed; }
+
+  // check if this item is a placeholder for entries without items, placeholders
+  // have no entry, and are always the last child of their parent
+  //
+  bool isPlaceholder() const { return m_Placeholder; }
+
+  // retrieve the entries this placeholder stands for
+  //
+  std::vector<std::shared_ptr<MOBase::FileTreeEntry>> const& pending() const {
+    return m_Pending;
+  }
+
   // replace the entry corresponding to this item
   //
   void setEntry(std::shared_ptr<MOBase::FileTreeEntry> entry) {
@@ -58,10 +112,6 @@ public:
     return m_Entry;
   }
 
-  // overriden method to avoid propagating dataChanged events
-  //
-  void setData(int column, int role, const QVariant& value) override;
-
   ArchiveTreeWidgetItem* parent() const {
     return static_cast<ArchiveTreeWidgetItem*>(QTreeWidgetItem::parent());
   }
@@ -72,9 +122,28 @@ public:
 
 protected:
 
+  // update the text of this placeholder from the number of pending entries
+  //
+  void updatePlaceholder();
+
   std::shared_ptr<MOBase::FileTreeEntry> m_Entry;
   bool m_Populated = false;
 
+  bool m_Placeholder = false;
+  std::vector<std::shared_ptr<MOBase::FileTreeEntry>> m_Pending;
+
+  // nested archives are listed in a worker thread on first expansion, the widget
+  // keeps track of the items being listed until the listing is added
+  bool m_Nested = false;
+  bool m_Listed = false;
+  bool m_ListingStarted = false;
+  std::future<std::optional<std::vector<ArchiveTreeWidgetItem*>>> m_Listing;
+  ArchiveTreeWidget* m_ListingWidget = nullptr;
+
+  // the budget tracking the children of this item, if any
+  MemoryBudget* m_Budget = nullptr;
+  int m_BudgetCache = -1;
+
   friend class ArchiveTreeWidget;
 };
 
@@ -89,6 +158,7 @@ class ArchiveTreeWidget : public QTreeWidget
 public:
 
   explicit ArchiveTreeWidget(QWidget* parent = 0);
+  ~ArchiveTreeWidget();
   void setup(QString dataFolderName);
 
 public:
@@ -97,6 +167,16 @@ public:
   //
   void setDataRoot(ArchiveTreeWidgetItem* const root);
 
+  // merge the checked content of the given directories into the first one and set it
+  // as the data root, folders present in several directories are merged and files
+  // present in several directories are taken from the last directory containing them,
+  // unchecked items stay where they are, including in partially checked folders
+  //
+  // the user is asked for confirmation if files are replaced, return false if the
+  // directories cannot be merged or if the user cancelled
+  //
+  bool setDataRoots(std::vector<ArchiveTreeWidgetItem*> const& roots);
+
   // create a directory under the given tree item, without
   // performing any check
   //
@@ -106,12 +186,164 @@ public:
   //
   ArchiveTreeWidgetItem* root() const { return m_ViewRoot; }
 
+  // call the given function for every file under the given item, with a boolean
+  // indicating if the file is checked or not
+  //
+  // this method does not populate the tree, for non-populated items, all the files
+  // under it have the same state as the item
+  //
+  void forEachFile(
+    ArchiveTreeWidgetItem* item,
+    std::function<void(const MOBase::FileTreeEntry*, bool)> const& callback) const;
+
+  // call the given function for every selected item, until the function returns
+  // false
+  //
+  // unlike selectedItems(), this does not build the list of selected items but
+  // iterates the ranges of the selection model directly
+  //
+  void forEachSelected(std::function<bool(ArchiveTreeWidgetItem*)> const& callback) const;
+
+  // check or uncheck all the selected items, treeChanged() is only emitted once
+  // at the end
+  //
+  void setSelectedCheckState(Qt::CheckState state);
+
+  // move the selected items under the given directory, as if they were dropped on
+  // it, return false if they cannot be moved (the user is warned)
+  //
+  bool moveSelected(ArchiveTreeWidgetItem* target);
+
+  // build the flat image of the current content of the given directory, including
+  // its unchecked items but not the content of nested archives, the image is built
+  // in the calling thread and is outdated as soon as the tree is modified
+  //
+  std::shared_ptr<const FlatFileTree> currentImage(
+    ArchiveTreeWidgetItem* item, FlatFileTree::SizeFunction sizeOf = {}) const;
+
+  // replace the selection by the items of the given nodes of a flat image of the
+  // current tree (see currentImage()), creating the missing items along the way,
+  // nodes that are not under the data root are ignored, return the number of
+  // selected items
+  //
+  // nodes are mapped to items through the keys of the image, which are compared but
+  // never dereferenced - the selection model is only updated once
+  //
+  std::size_t selectNodes(FlatFileTree const& tree, std::vector<FlatFileTree::Index> const& nodes);
+
+  // the entries of the selected items (placeholders excluded)
+  //
+  std::vector<const MOBase::FileTreeEntry*> selectedEntries() const;
+
+  // populate the given item and all the items under it
+  //
+  void populateAll(ArchiveTreeWidgetItem* item);
+
+  // if true, remove the child items of directories that are collapsed and fully
+  // checked, they are re-created when the directory is expanded again
+  //
+  void setDepopulateCollapsed(bool depopulate);
+
+  // show at most pageSize items for directories with more than threshold entries,
+  // the remaining entries are represented by a placeholder item, 0 to show all the
+  // entries
+  //
+  // operations on the directory itself (checking, moving) always apply to all of
+  // its entries, whether they have an item or not
+  //
+  void setPaging(std::size_t threshold, std::size_t pageSize);
+
+  // the number of items shown per page, 0 if paging is disabled
+  //
+  std::size_t pageSize() const { return m_PageThreshold > 0 ? m_PageSize : 0; }
+
+  // create the items for the next count entries of the given placeholder, removing
+  // the placeholder if there are no entries left
+  //
+  void showPending(ArchiveTreeWidgetItem* placeholder, std::size_t count);
+
+  // show the number of files and the size of the checked content of collapsed
+  // directories next to their name, the counts are computed in a worker thread and
+  // updated after every change
+  //
+  // the size function is called from the worker thread so it must be thread-safe,
+  // and must stay valid until this is called again or the widget is destroyed
+  //
+  void setDirectoryCounts(bool enabled, DirectoryCounts::SizeFunction sizeOf = {});
+
+  // set the source used to read nested archives when they are expanded, without a
+  // source, nested archives cannot be listed
+  //
+  void setArchiveSource(std::shared_ptr<const ArchiveSource> source);
+
+  // set the image of the original archive, used to find the original path of the
+  // nested archives since the user may have moved them
+  //
+  void setOriginalTree(std::shared_ptr<const FlatFileTree> tree);
+
+  // limit the memory used by the items of collapsed directories and of nested archives,
+  // the items of the least recently used ones are deleted and re-created when they
+  // are expanded again, 0 for no limit
+  //
+  void setMemoryBudget(std::uint64_t bytes);
+
+  // the budget, to report its usage or to track other caches
+  //
+  MemoryBudget& memoryBudget() { return m_Budget; }
+
+  // retrieve the current generation of the tree, which is incremented every time
+  // the tree is modified
+  //
+  std::uint64_t generation() const { return m_Generation; }
+
+  // retrieve a token that is cancelled the next time the tree is modified, for
+  // tasks whose result depends on the current content of the tree
+  //
+  CancellationToken editToken() const { return m_Edits.token(); }
+
+  // the scheduler running the background work of this widget, which can also be
+  // used for other work related to the tree
+  //
+  TaskScheduler& scheduler() { return m_Scheduler; }
+
+  // retrieve an immutable snapshot of the content of the data root at the current
+  // generation, that can be safely used from worker threads
+  //
+  std::shared_ptr<const FileTreeSnapshot> snapshot();
+
+  // delete all the items, including the items outside of the widget that contain the
+  // data root (the original root), wait for the background work and release the
+  // caches related to the content - the widget cannot be used afterwards
+  //
+  // return the number of items deleted, 0 if the content was already released
+  //
+  std::size_t releaseContent();
+
 signals:
 
   // emitted when the tree has been modified
   //
   void treeChanged();
 
+  // emitted when the user changed the check state of the given item, before
+  // treeChanged()
+  //
+  void checkStateChanged(ArchiveTreeWidgetItem* item);
+
+  // emitted when the data root has been changed, before treeChanged()
+  //
+  void dataRootChanged();
+
+  // emitted when items have been dropped, after all the moves have been
+  // performed
+  //
+  void itemsMoved();
+
+  // emitted when the content of the data root has changed, before treeChanged(),
+  // with the changes to the entries directly under the data root
+  //
+  void dataRootContentChanged(DataRootDelta const& delta);
+
 public slots:
 
 protected:
@@ -145,10 +377,26 @@ protected:
   //
   void populateItem(QTreeWidgetItem* item);
 
+  // slot that removes the child items of the given item if possible (see
+  // setDepopulateCollapsed)
+  //
+  void depopulateItem(QTreeWidgetItem* item);
+
   // move the source under the target
   //
   void moveItem(ArchiveTreeWidgetItem* source, ArchiveTreeWidgetItem* target);
 
+  // move the checked content of the source directory into the target directory,
+  // partially checked folders are merged recursively so that their unchecked items
+  // stay in the source
+  //
+  void moveCheckedContent(ArchiveTreeWidgetItem* source, ArchiveTreeWidgetItem* target);
+
+  // change the state of the given item and update the tree accordingly, this is
+  // used for all the changes that are not made by the user directly on the item
+  //
+  void setItemCheckState(ArchiveTreeWidgetItem* item, Qt::CheckState state);
+
   // called when the state of the item changed - unlike the standard QTreeWidget,
   // this is only called for the actual item, not its parent/children
   //
@@ -156,18 +404,172 @@ protected:
 
   void dragEnterEvent(QDragEnterEvent *event) override;
   void dragMoveEvent(QDragMoveEvent *event) override;
+  void dragLeaveEvent(QDragLeaveEvent* event) override;
   void dropEvent(QDropEvent *event) override;
 
 private:
 
+  // speculative population of the directory hovered during a drag: when the drag
+  // lingers on a non-populated directory, its child items are created in a background
+  // thread, so that they are ready when the directory is auto-expanded
+  //
+  // the background thread only reads the child list of the hovered directory, which
+  // cannot be modified during a drag, and is always waited for when the drag ends
+  //
+  struct Prefetch {
+    ArchiveTreeWidgetItem* item = nullptr;
+    std::uint64_t generation = 0;
+    std::future<std::optional<std::vector<ArchiveTreeWidgetItem*>>> children;
+  };
+
+  // the number of items to create when populating a directory with the given
+  // number of entries
+  //
+  std::size_t pageLimit(std::size_t count) const;
+
+  // start preparing the children of the hovered item
+  //
+  void startPrefetch();
+
+  // wait for the background preparation to finish, without discarding it
+  //
+  void waitPrefetch();
+
+  // wait for the background preparation and discard it
+  //
+  void discardPrefetch();
+
+  // retrieve the prepared children for the given item, if any, the prepared children
+  // are only returned if the tree has not changed since the preparation started
+  //
+  std::optional<std::vector<ArchiveTreeWidgetItem*>> takePrefetched(ArchiveTreeWidgetItem* item);
+
   bool testMovePossible(ArchiveTreeWidgetItem* source, ArchiveTreeWidgetItem* target);
 
+  // track the children of the given populated item in the memory budget, without
+  // enforcing it
+  //
+  void trackSubtree(ArchiveTreeWidgetItem* item);
+
   // refresh the given item (after a drop)
   //
   void refreshItem(ArchiveTreeWidgetItem* item);
 
-  // the widget item that emitted the dataChanged event
-  ArchiveTreeWidgetItem* m_Emitter = nullptr;
+  // start counting the files of the directories in a worker thread, or mark the
+  // counts as outdated if the worker is already running
+  //
+  void startDirectoryCounts();
+
+  // wait for the counting worker and discard its result
+  //
+  void discardDirectoryCounts();
+
+  // apply the counts computed by the given task, unless they have been discarded, and
+  // start the counts again if the tree changed while the task was running, the counts
+  // are null if the task was skipped
+  //
+  void applyDirectoryCounts(std::shared_ptr<const DirectoryCounts> counts, std::uint64_t sequence);
+
+  // start listing the content of the given nested archive in a worker thread
+  //
+  void startListing(ArchiveTreeWidgetItem* item);
+
+  // add the listing that has been read for the given item, if it still exists
+  //
+  void applyListing(ArchiveTreeWidgetItem* item);
+
+  // updates posted by the background tasks, by item (null for updates of the whole
+  // view), the updates of a frame are merged and applied together
+  //
+  struct Update {
+    bool listing = false;
+    std::shared_ptr<const DirectoryCounts> counts;
+    std::uint64_t countSequence = 0;
+
+    // the counts task was outdated before it started and did not compute anything
+    bool countsSkipped = false;
+  };
+  using UpdateChannel = ResultChannel<ArchiveTreeWidgetItem*, Update>;
+
+  void applyUpdates(UpdateChannel::Batch& batch);
+
+  // evict the items under the given item from the memory budget, if it is not
+  // visible
+  //
+  bool evictSubtree(ArchiveTreeWidgetItem* item);
+  bool evictListing(ArchiveTreeWidgetItem* item);
+
+  // update the text of the given item (if it is a collapsed directory) or of the
+  // given item and the items under it with the current counts
+  //
+  void decorateItem(ArchiveTreeWidgetItem* item);
+  void decorateAll(ArchiveTreeWidgetItem* item);
+
+  // record the existence of the given entry of the data root, or of the entry of
+  // the data root containing the given item, before a change - the recorded entries
+  // are compared with the current ones when emitting the delta
+  //
+  void touchDataRoot(QString const& name);
+  void touchDataRoot(ArchiveTreeWidgetItem* item);
+  void emitDataRootDelta();
+
+  // invalidate the snapshot nodes of the given item and of its parents, this must
+  // be called every time the entries under the given item are modified
+  //
+  void invalidateSnapshot(ArchiveTreeWidgetItem* item, bool recursive);
+
+  // the ranges of selected rows, by parent, in an order suitable for removing the
+  // rows one range after another (last rows first)
+  //
+  struct SelectionRange {
+    ArchiveTreeWidgetItem* parent;
+    int top;
+    int bottom;
+  };
+  std::vector<SelectionRange> selectionRanges() const;
+
+  // true while performing an operation on multiple items, to avoid emitting
+  // treeChanged() for each of them
+  bool m_BatchUpdate = false;
+
+  QMetaObject::Connection m_DepopulateConnection;
+
+  // see setPaging()
+  std::size_t m_PageThreshold = 0;
+  std::size_t m_PageSize = 0;
+
+  // entries of the data root touched by the current change, with their
+  // existence before the change
+  std::map<QString, bool, MOBase::FileNameComparator> m_Touched;
+
+  // see setDirectoryCounts()
+  bool m_CountDirectories = false;
+  DirectoryCounts::SizeFunction m_SizeOf;
+  QTimer m_CountTimer;
+  std::future<std::optional<bool>> m_CountFuture;
+  std::uint64_t m_CountSequence = 0;
+  std::shared_ptr<const DirectoryCounts> m_Counts;
+  bool m_CountOutdated = false;
+
+  // see setArchiveSource(), and nested archives being listed
+  std::shared_ptr<const ArchiveSource> m_Source;
+  std::shared_ptr<const FlatFileTree> m_OriginalTree;
+  std::set<ArchiveTreeWidgetItem*> m_Listings;
+
+  // hovered item and timer to start the prefetch
+  ArchiveTreeWidgetItem* m_HoverItem = nullptr;
+  QTimer m_HoverTimer;
+  Prefetch m_Prefetch;
+
+  std::uint64_t m_Generation = 0;
+  CancellationSource m_Edits;
+  TaskScheduler m_Scheduler;
+  UpdateChannel m_Updates;
+
+  MemoryBudget m_Budget;
+  int m_SubtreeCache;
+  int m_ListingCache;
+  FileTreeSnapshotBuilder m_SnapshotBuilder;
 
   // IMPORTANT: if you intend to work on this and understand this, read the detailed
   // explanation at the beginning of the archivetree.cpp file
@@ -181,6 +583,7 @@ private:
   ArchiveTreeWidgetItem* m_ViewRoot;
 
   friend class ArchiveTreeWidgetItem;
+  friend class CheckStateDelegate;
 
 };
 
@@ -0,0 +1,331 @@
+/*
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This file is part of Mod Organizer.
+
+Mod Organizer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Mod Organizer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Mod Organizer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+// the benchmark is only part of benchmark builds, see INSTALLERMANUAL_BENCHMARK in
+// the build files
+#ifdef INSTALLERMANUAL_BENCHMARK
+
+#include "dialogbenchmark.h"
+
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <utility>
+
+#include <QApplication>
+#include <QDropEvent>
+#include <QElapsedTimer>
+#include <QMimeData>
+#include <QScrollBar>
+#include <QStringList>
+#include <QTimer>
+
+#include <log.h>
+
+#include "installdialog.h"
+
+using namespace MOBase;
+
+namespace {
+
+// tree that is not backed by anything, built with addFile() and addDirectory()
+class SyntheticFileTree : public IFileTree {
+public:
+
+  SyntheticFileTree(std::shared_ptr<const IFileTree> parent, QString name) :
+    FileTreeEntry(parent, name), IFileTree() { }
+
+protected:
+
+  std::shared_ptr<IFileTree> makeDirectory(
+    std::shared_ptr<const IFileTree> parent, QString name) const override {
+    return std::make_shared<SyntheticFileTree>(parent, name);
+  }
+
+  bool doPopulate(
+    std::shared_ptr<const IFileTree>, std::vector<std::shared_ptr<FileTreeEntry>>&) const override {
+    return true;
+  }
+
+  std::shared_ptr<IFileTree> doClone() const override {
+    return std::make_shared<SyntheticFileTree>(nullptr, name());
+  }
+
+};
+
+// record the paints of a widget
+class PaintMonitor : public QObject {
+public:
+
+  PaintMonitor(QWidget* widget) : m_Widget(widget) {
+    widget->installEventFilter(this);
+  }
+
+  ~PaintMonitor() {
+    m_Widget->removeEventFilter(this);
+  }
+
+  // process events until the widget is painted or the timeout expires, return
+  // false if the widget was not painted
+  //
+  bool waitPaint(int timeout = 5000) {
+    QElapsedTimer timer;
+    timer.start();
+    while (!m_Painted && timer.elapsed() < timeout) {
+      QApplication::processEvents(QEventLoop::AllEvents, 16);
+    }
+    return std::exchange(m_Painted, false);
+  }
+
+  void reset() { m_Painted = false; }
+
+  bool eventFilter(QObject* object, QEvent* event) override {
+    if (object == m_Widget && event->type() == QEvent::Paint) {
+      m_Painted = true;
+    }
+    return false;
+  }
+
+private:
+  QWidget* m_Widget;
+  bool m_Painted = false;
+};
+
+// run the given action, and wait for the next paint of the view, returning the
+// elapsed time in ms
+double frame(PaintMonitor& monitor, ArchiveTreeWidget* view, std::function<void()> const& action)
+{
+  QElapsedTimer timer;
+  monitor.reset();
+  timer.start();
+  action();
+  view->viewport()->update();
+  monitor.waitPaint();
+  return timer.nsecsElapsed() / 1e6;
+}
+
+// select the (non-placeholder) children of the given directory
+void selectChildren(ArchiveTreeWidget* view, ArchiveTreeWidgetItem* item)
+{
+  view->clearSelection();
+  item->populate();
+  for (int i = 0; i < item->childCount(); ++i) {
+    if (!item->child(i)->isPlaceholder()) {
+      item->child(i)->setSelected(true);
+    }
+  }
+}
+
+// drop the selection on the given item
+void drop(ArchiveTreeWidget* view, ArchiveTreeWidgetItem* target)
+{
+  view->scrollToItem(target);
+  QMimeData data;
+  QDropEvent event(
+    view->visualItemRect(target).center(), Qt::MoveAction, &data, Qt::LeftButton, Qt::NoModifier);
+  QApplication::sendEvent(view->viewport(), &event);
+}
+
+}
+
+QString DialogBenchmark::Result::toString() const
+{
+  QStringList lines;
+  lines.append(QString("first paint: %1ms, interactive: %2ms").arg(firstPaint, 0, 'f', 1).arg(interactive, 0, 'f', 1));
+  for (auto& [name, frames] : scenarios) {
+    lines.append(QString("%1: %2 frames, p50 %3ms, p90 %4ms, p99 %5ms, max %6ms")
+      .arg(name).arg(frames.count)
+      .arg(frames.p50, 0, 'f', 1).arg(frames.p90, 0, 'f', 1)
+      .arg(frames.p99, 0, 'f', 1).arg(frames.max, 0, 'f', 1));
+  }
+  return lines.join("\n");
+}
+
+std::shared_ptr<IFileTree> DialogBenchmark::synthetic(
+  std::size_t entries, std::size_t fanout, std::size_t depth)
+{
+  static const QStringList extensions{ "esp", "dds", "nif", "txt", "ini", "wav", "bsa" };
+
+  auto root = std::make_shared<SyntheticFileTree>(nullptr, "");
+
+  // the tree is built breadth-first so that all the levels are filled if there are
+  // not enough entries, one entry in eight is a directory
+  std::deque<std::pair<std::shared_ptr<IFileTree>, std::size_t>> queue{ { root, 0 } };
+  std::size_t created = 0;
+  while (!queue.empty() && created < entries) {
+    auto [tree, level] = queue.front();
+    queue.pop_front();
+
+    const std::size_t directories = level + 1 < depth ? fanout / 8 + 1 : 0;
+    for (std::size_t i = 0; i < fanout && created < entries; ++i, ++created) {
+      if (i < directories) {
+        queue.emplace_back(tree->addDirectory(QString("folder%1").arg(i)), level + 1);
+      }
+      else {
+        tree->addFile(QString("file%1.%2").arg(i).arg(extensions[static_cast<int>(i % extensions.size())]));
+      }
+    }
+  }
+
+  return root;
+}
+
+std::shared_ptr<IFileTree> DialogBenchmark::synthetic(QString const& specification)
+{
+  const QStringList parts = specification.split(':');
+  if (parts.size() != 3) {
+    return nullptr;
+  }
+
+  std::size_t values[3];
+  for (int i = 0; i < 3; ++i) {
+    bool ok;
+    values[i] = parts[i].toULongLong(&ok);
+    if (!ok || values[i] == 0) {
+      return nullptr;
+    }
+  }
+
+  return synthetic(values[0], values[1], values[2]);
+}
+
+DialogBenchmark::Result DialogBenchmark::run(
+  std::shared_ptr<IFileTree> tree, const IPluginGame* game, InstallProfile const& profile)
+{
+  Result result;
+
+  QElapsedTimer clock;
+  clock.start();
+
+  GuessedValue<QString> modName("benchmark");
+  InstallDialog dialog(tree, modName, game);
+  dialog.setProfile(profile);
+
+  ArchiveTreeWidget* view = dialog.treeWidget();
+  PaintMonitor monitor(view->viewport());
+
+  dialog.show();
+  monitor.waitPaint();
+  result.firstPaint = clock.nsecsElapsed() / 1e6;
+
+  // the dialog is considered interactive once zero-delay timers have been handled
+  // within 50ms for 500ms, i.e., once the initial work of the dialog does not block
+  // the event loop anymore
+  {
+    QElapsedTimer quiet;
+    quiet.start();
+    while (quiet.elapsed() < 500 && clock.elapsed() < 60000) {
+      QElapsedTimer latency;
+      latency.start();
+      bool handled = false;
+      QTimer::singleShot(0, [&handled]() { handled = true; });
+      while (!handled) {
+        QApplication::processEvents(QEventLoop::AllEvents | QEventLoop::WaitForMoreEvents);
+      }
+      if (latency.elapsed() > 50) {
+        quiet.restart();
+      }
+    }
+    result.interactive = (clock.nsecsElapsed() - quiet.nsecsElapsed()) / 1e6;
+  }
+
+  std::vector<double> frames;
+  auto scenario = [&](QString name) {
+    result.scenarios[name] = percentiles(std::move(frames));
+    frames.clear();
+  };
+
+  // expand the directories of the data root one by one, and collapse them back
+  auto* root = view->root();
+  root->populate();
+  for (int i = 0; i < root->childCount() && i < 100; ++i) {
+    auto* item = root->child(i);
+    if (item->isDirectory() && !item->isNestedArchive()) {
+      frames.push_back(frame(monitor, view, [&]() { view->expandItem(item); }));
+      frames.push_back(frame(monitor, view, [&]() { view->collapseItem(item); }));
+    }
+  }
+  scenario("expand");
+
+  frames.push_back(frame(monitor, view, [&]() { view->populateAll(root); view->expandAll(); }));
+  scenario("expand-all");
+
+  // scroll through the expanded tree, one page at a time, then back to the top
+  // using single steps
+  QScrollBar* scrollBar = view->verticalScrollBar();
+  while (scrollBar->value() < scrollBar->maximum() && frames.size() < 500) {
+    frames.push_back(frame(monitor, view, [&]() { scrollBar->setValue(scrollBar->value() + scrollBar->pageStep()); }));
+  }
+  for (int i = 0; i < 100 && scrollBar->value() > 0; ++i) {
+    frames.push_back(frame(monitor, view, [&]() { scrollBar->setValue(scrollBar->value() - scrollBar->singleStep()); }));
+  }
+  scenario("scroll");
+
+  // change the check state of large selections
+  for (int i = 0; i < 5; ++i) {
+    frames.push_back(frame(monitor, view, [&]() { view->selectAll(); }));
+    frames.push_back(frame(monitor, view, [&]() { view->setSelectedCheckState(Qt::Unchecked); }));
+    frames.push_back(frame(monitor, view, [&]() { view->setSelectedCheckState(Qt::Checked); }));
+    frames.push_back(frame(monitor, view, [&]() { view->clearSelection(); }));
+  }
+  scenario("select");
+
+  // move the content of the first directory back and forth between two new
+  // directories, these are empty so the drops never conflict
+  ArchiveTreeWidgetItem* source = nullptr;
+  for (int i = 0; i < root->childCount() && !source; ++i) {
+    if (root->child(i)->isDirectory() && !root->child(i)->isNestedArchive()) {
+      source = root->child(i);
+    }
+  }
+  if (source) {
+    ArchiveTreeWidgetItem* targets[] = {
+      view->addDirectory(root, "benchmark-a"), view->addDirectory(root, "benchmark-b") };
+    for (int i = 0; i < 10; ++i) {
+      selectChildren(view, source);
+      frames.push_back(frame(monitor, view, [&]() { drop(view, targets[i % 2]); }));
+      source = targets[i % 2];
+    }
+  }
+  scenario("drop");
+
+  dialog.hide();
+
+  log::info("benchmark of the installation dialog for {} entries:\n{}",
+    dialog.flatTree() ? dialog.flatTree()->size() : 0, result.toString());
+
+  return result;
+}
+
+DialogBenchmark::Frames DialogBenchmark::percentiles(std::vector<double> frames)
+{
+  if (frames.empty()) {
+    return { 0, 0, 0, 0, 0 };
+  }
+
+  std::sort(frames.begin(), frames.end());
+  auto at = [&frames](double p) {
+    return frames[static_cast<std::size_t>(p * (frames.size() - 1) + 0.5)];
+  };
+  return { frames.size(), at(0.5), at(0.9), at(0.99), frames.back() };
+}
+
+#endif // INSTALLERMANUAL_BENCHMARK
@@ -0,0 +1,103 @@
+/*
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This file is part of Mod Organizer.
+
+Mod Organizer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Mod Organizer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Mod Organizer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#ifndef DIALOGBENCHMARK_H
+#define DIALOGBENCHMARK_H
+
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <QString>
+
+#include <ifiletree.h>
+#include <iplugingame.h>
+
+#include "installprofile.h"
+
+class InstallDialog;
+
+// scripted benchmark of the installation dialog
+//
+// the dialog is shown for a given tree and driven by a script that scrolls the
+// tree, expands it, changes the check state of a large selection and drops items,
+// each step being followed by a repaint of the tree - the time to the first paint,
+// the time until the dialog becomes interactive and the percentiles of the frame
+// times of each scenario are reported
+//
+// the benchmark does not depend on the windowing system and can be run with Qt's
+// offscreen platform (QT_QPA_PLATFORM=offscreen)
+//
+class DialogBenchmark
+{
+public:
+
+  struct Frames {
+    std::size_t count;
+    double p50, p90, p99, max;
+  };
+
+  struct Result {
+
+    // from the creation of the dialog to the first paint of the tree, in ms
+    double firstPaint;
+
+    // from the creation of the dialog until the event loop remained responsive
+    // for a while, in ms
+    double interactive;
+
+    // frame times of each scenario, in ms
+    std::map<QString, Frames> scenarios;
+
+    // format the result for the log
+    //
+    QString toString() const;
+  };
+
+public:
+
+  // create a synthetic tree of the given number of entries, where each directory
+  // contains the given number of entries and where directories are nested up to
+  // the given depth
+  //
+  static std::shared_ptr<MOBase::IFileTree> synthetic(
+    std::size_t entries, std::size_t fanout, std::size_t depth);
+
+  // create a synthetic tree from a specification of the form
+  // "<entries>:<fanout>:<depth>", return a null pointer if the specification is
+  // not valid
+  //
+  static std::shared_ptr<MOBase::IFileTree> synthetic(QString const& specification);
+
+  // run the benchmark for the given tree, the dialog is created, shown, driven and
+  // closed, the tree is modified by the benchmark
+  //
+  static Result run(
+    std::shared_ptr<MOBase::IFileTree> tree, const MOBase::IPluginGame* game,
+    InstallProfile const& profile);
+
+private:
+
+  static Frames percentiles(std::vector<double> frames);
+
+};
+
+#endif // DIALOGBENCHMARK_H
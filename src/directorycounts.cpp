@@ -0,0 +1,83 @@
+/*
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This file is part of Mod Organizer.
+
+Mod Organizer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Mod Organizer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Mod Organizer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "directorycounts.h"
+
+using namespace MOBase;
+
+std::shared_ptr<const DirectoryCounts> DirectoryCounts::compute(
+  std::shared_ptr<const FileTreeSnapshot> snapshot, SizeFunction const& sizeOf,
+  std::shared_ptr<const DirectoryCounts> previous)
+{
+  using Entry = FileTreeSnapshot::Entry;
+
+  auto counts = std::make_shared<DirectoryCounts>();
+  counts->m_Snapshot = snapshot;
+  counts->m_HasSizes = static_cast<bool>(sizeOf);
+
+  // counts computed without sizes cannot be reused when sizes are available
+  if (previous && previous->m_HasSizes != counts->m_HasSizes) {
+    previous = nullptr;
+  }
+
+  // copy the counts of an unmodified directory and of the directories under it,
+  // this only visits directories
+  std::function<void(Entry)> copy = [&](Entry entry) {
+    counts->m_Counts.emplace(entry.key(), previous->m_Counts.at(entry.key()));
+    for (std::size_t i = 0; i < entry.childCount(); ++i) {
+      if (entry.child(i).isDir()) {
+        copy(entry.child(i));
+      }
+    }
+  };
+
+  std::function<Count(Entry)> visit = [&](Entry entry) {
+    if (previous) {
+      auto it = previous->m_Counts.find(entry.key());
+      if (it != previous->m_Counts.end() && it->second.identity == entry.identity()) {
+        copy(entry);
+        return it->second.count;
+      }
+    }
+
+    Count count;
+    count.files = entry.fileCount();
+    for (std::size_t i = 0; i < entry.childCount(); ++i) {
+      auto child = entry.child(i);
+      if (child.isDir()) {
+        count.bytes += visit(child).bytes;
+      }
+      else if (sizeOf) {
+        count.bytes += sizeOf(child.key());
+      }
+    }
+
+    counts->m_Counts.emplace(entry.key(), Value{ entry.identity(), count });
+    return count;
+  };
+  visit(snapshot->root());
+
+  return counts;
+}
+
+const DirectoryCounts::Count* DirectoryCounts::find(const FileTreeEntry* entry) const
+{
+  auto it = m_Counts.find(entry);
+  return it != m_Counts.end() ? &it->second.count : nullptr;
+}
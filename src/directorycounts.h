@@ -0,0 +1,90 @@
+/*
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This file is part of Mod Organizer.
+
+Mod Organizer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Mod Organizer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Mod Organizer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DIRECTORYCOUNTS_H
+#define DIRECTORYCOUNTS_H
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+
+#include "ifiletree.h"
+#include "treesnapshot.h"
+
+// recursive number of files and total size of every directory of a snapshot
+//
+// counts are computed from a snapshot so that they can be computed in a worker
+// thread, and reuse the counts of a previous snapshot for directories whose node
+// is shared with it, so only the modified directories are traversed again
+//
+class DirectoryCounts {
+public:
+
+  struct Count {
+    std::size_t files = 0;
+    std::uint64_t bytes = 0;
+  };
+
+  using SizeFunction = std::function<std::uint64_t(const MOBase::FileTreeEntry*)>;
+
+  /**
+   * @brief Count the files under every directory of the given snapshot.
+   *
+   * @param snapshot The snapshot to count.
+   * @param sizeOf Function returning the size of a file, can be empty if sizes are
+   *     not known. This is called from the calling thread, so it must be thread-safe.
+   * @param previous Counts for a previous snapshot of the same tree, computed with
+   *     the same size function, or a null pointer.
+   */
+  static std::shared_ptr<const DirectoryCounts> compute(
+    std::shared_ptr<const FileTreeSnapshot> snapshot, SizeFunction const& sizeOf,
+    std::shared_ptr<const DirectoryCounts> previous = nullptr);
+
+public:
+
+  // the generation of the snapshot these counts were computed for
+  //
+  std::uint64_t generation() const { return m_Snapshot->generation(); }
+
+  // check if the counts include sizes
+  //
+  bool hasSizes() const { return m_HasSizes; }
+
+  // retrieve the counts for the given directory, or a null pointer if the directory
+  // was not in the snapshot
+  //
+  const Count* find(const MOBase::FileTreeEntry* entry) const;
+
+private:
+
+  struct Value {
+    const void* identity;
+    Count count;
+  };
+
+  // the snapshot is kept alive so that the identities of its nodes cannot be
+  // reused by the nodes of another snapshot
+  std::shared_ptr<const FileTreeSnapshot> m_Snapshot;
+  std::unordered_map<const MOBase::FileTreeEntry*, Value> m_Counts;
+  bool m_HasSizes = false;
+
+};
+
+#endif // DIRECTORYCOUNTS_H
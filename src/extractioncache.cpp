@@ -0,0 +1,289 @@
+/*
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This file is part of Mod Organizer.
+
+Mod Organizer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Mod Organizer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Mod Organizer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "extractioncache.h"
+
+#include <algorithm>
+#include <array>
+#include <set>
+#include <vector>
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+
+#include <log.h>
+
+#include "archiveindex.h"
+
+using namespace MOBase;
+
+static const QString MANIFEST = "manifest.json";
+
+static QString hashId(QString const& text)
+{
+  return QString::fromLatin1(QCryptographicHash::hash(text.toUtf8(), QCryptographicHash::Sha1).toHex());
+}
+
+ExtractionCache::Key ExtractionCache::contentKey(std::uint32_t crc, std::uint64_t size)
+{
+  return { QString("crc-%1-%2").arg(crc, 8, 16, QChar('0')).arg(static_cast<qulonglong>(size)), crc };
+}
+
+ExtractionCache::Key ExtractionCache::entryKey(QString const& fingerprint, QString const& path)
+{
+  return { "entry-" + hashId(fingerprint + "\n" + ArchiveIndex::normalize(path)), std::nullopt };
+}
+
+QString ExtractionCache::fingerprint(QString const& archivePath)
+{
+  const QFileInfo info(archivePath);
+  return QString("%1\n%2\n%3")
+    .arg(info.absoluteFilePath().toLower())
+    .arg(info.size())
+    .arg(info.lastModified().toMSecsSinceEpoch());
+}
+
+std::optional<std::uint32_t> ExtractionCache::crc32(QString const& path)
+{
+  static const auto table = [] {
+    std::array<std::uint32_t, 256> table{};
+    for (std::uint32_t i = 0; i < 256; ++i) {
+      std::uint32_t c = i;
+      for (int k = 0; k < 8; ++k) {
+        c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+      }
+      table[i] = c;
+    }
+    return table;
+  }();
+
+  QFile file(path);
+  if (!file.open(QIODevice::ReadOnly)) {
+    return std::nullopt;
+  }
+
+  std::uint32_t crc = 0xFFFFFFFFu;
+  while (!file.atEnd()) {
+    const QByteArray chunk = file.read(1 << 16);
+    if (chunk.isEmpty()) {
+      return std::nullopt;
+    }
+    for (char c : chunk) {
+      crc = table[(crc ^ static_cast<std::uint8_t>(c)) & 0xFF] ^ (crc >> 8);
+    }
+  }
+
+  return crc ^ 0xFFFFFFFFu;
+}
+
+ExtractionCache::ExtractionCache(QString directory, std::uint64_t capacity) :
+  m_Directory(std::move(directory)), m_Capacity(capacity)
+{
+  QDir().mkpath(m_Directory);
+  load();
+}
+
+ExtractionCache::~ExtractionCache()
+{
+  if (m_Dirty) {
+    save();
+  }
+}
+
+QString ExtractionCache::folder(QString const& id) const
+{
+  return QDir(m_Directory).filePath(hashId(id));
+}
+
+QString ExtractionCache::find(Key const& key)
+{
+  auto it = m_Items.find(key.id);
+  if (it == m_Items.end()) {
+    return {};
+  }
+
+  auto& item = it->second;
+  const QString path = QDir(folder(key.id)).filePath(item.name);
+
+  // the copy may have been opened and modified, or removed
+  const QFileInfo info(path);
+  const auto crc = info.exists() && static_cast<std::uint64_t>(info.size()) == item.size ? crc32(path) : std::nullopt;
+  if (!crc || *crc != item.crc || (key.crc && *key.crc != item.crc)) {
+    log::debug("cached copy of '{}' has been modified, discarding it", item.name);
+    if (remove(key.id)) {
+      save();
+    }
+    return {};
+  }
+
+  item.used = QDateTime::currentMSecsSinceEpoch();
+  m_Dirty = true;
+
+  return path;
+}
+
+QString ExtractionCache::insert(Key const& key, QString const& name, QString const& path)
+{
+  const QFileInfo info(path);
+  const auto size = static_cast<std::uint64_t>(info.size());
+  if (!info.isFile() || size > m_Capacity) {
+    return {};
+  }
+
+  const auto crc = crc32(path);
+  if (!crc || (key.crc && *key.crc != *crc)) {
+    log::warn("extracted file '{}' does not match its CRC, not caching it", name);
+    return {};
+  }
+
+  // the previous copy may still be opened
+  if (!remove(key.id)) {
+    return {};
+  }
+  evict(size);
+  if (m_Size + size > m_Capacity) {
+    return {};
+  }
+
+  const QString directory = folder(key.id);
+  const QString target = QDir(directory).filePath(name);
+  if (!QDir().mkpath(directory) || !QFile::copy(path, target)) {
+    log::debug("failed to copy '{}' to the extraction cache", name);
+    QDir(directory).removeRecursively();
+    return {};
+  }
+
+  m_Items[key.id] = { name, size, *crc, QDateTime::currentMSecsSinceEpoch() };
+  m_Size += size;
+  save();
+
+  return target;
+}
+
+bool ExtractionCache::remove(QString const& id)
+{
+  auto it = m_Items.find(id);
+  if (it == m_Items.end()) {
+    return true;
+  }
+
+  if (!QDir(folder(id)).removeRecursively()) {
+    log::debug("failed to remove '{}' from the extraction cache", it->second.name);
+    return false;
+  }
+
+  m_Size -= it->second.size;
+  m_Items.erase(it);
+  m_Dirty = true;
+  return true;
+}
+
+void ExtractionCache::evict(std::uint64_t incoming)
+{
+  if (m_Size + incoming <= m_Capacity) {
+    return;
+  }
+
+  std::vector<std::pair<qint64, QString>> candidates;
+  candidates.reserve(m_Items.size());
+  for (auto& [id, item] : m_Items) {
+    candidates.emplace_back(item.used, id);
+  }
+  std::sort(candidates.begin(), candidates.end());
+
+  for (auto& candidate : candidates) {
+    if (m_Size + incoming <= m_Capacity) {
+      break;
+    }
+    remove(candidate.second);
+  }
+}
+
+void ExtractionCache::load()
+{
+  QFile file(QDir(m_Directory).filePath(MANIFEST));
+  const QJsonObject items = file.open(QIODevice::ReadOnly) ?
+    QJsonDocument::fromJson(file.readAll()).object() : QJsonObject();
+  for (auto it = items.begin(); it != items.end(); ++it) {
+    const QJsonObject object = it.value().toObject();
+    Item item{
+      object["name"].toString(),
+      static_cast<std::uint64_t>(object["size"].toDouble()),
+      static_cast<std::uint32_t>(object["crc"].toDouble()),
+      static_cast<qint64>(object["used"].toDouble())
+    };
+
+    // names are used as file names, so they must not escape the folder
+    if (item.name.isEmpty() || item.name.contains('/') || item.name.contains('\\')) {
+      continue;
+    }
+
+    m_Size += item.size;
+    m_Items.emplace(it.key(), std::move(item));
+  }
+
+  // the folders that are not in the manifest could not be removed when their file
+  // was discarded, or were left by an interrupted session
+  std::set<QString> folders;
+  for (auto& [id, item] : m_Items) {
+    folders.insert(hashId(id));
+  }
+
+  const QDir directory(m_Directory);
+  for (auto& name : directory.entryList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+    if (!folders.count(name)) {
+      QDir(directory.filePath(name)).removeRecursively();
+    }
+  }
+
+  // the capacity may have been reduced since the last session
+  evict(0);
+  if (m_Dirty) {
+    save();
+  }
+}
+
+void ExtractionCache::save()
+{
+  m_Dirty = false;
+
+  QJsonObject items;
+  for (auto& [id, item] : m_Items) {
+    items[id] = QJsonObject{
+      { "name", item.name },
+      { "size", static_cast<double>(item.size) },
+      { "crc", static_cast<double>(item.crc) },
+      { "used", static_cast<double>(item.used) }
+    };
+  }
+
+  QSaveFile file(QDir(m_Directory).filePath(MANIFEST));
+  if (!file.open(QIODevice::WriteOnly)) {
+    return;
+  }
+  file.write(QJsonDocument(items).toJson(QJsonDocument::Compact));
+  file.commit();
+}
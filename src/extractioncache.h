@@ -0,0 +1,161 @@
+/*
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This file is part of Mod Organizer.
+
+Mod Organizer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Mod Organizer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Mod Organizer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef EXTRACTIONCACHE_H
+#define EXTRACTIONCACHE_H
+
+#include <cstdint>
+#include <map>
+#include <optional>
+
+#include <QString>
+
+// cache of extracted files on disk, shared by all the installation sessions
+//
+// files are identified either by their content, when the archive provides a CRC,
+// so that the same file is shared between archives, or by the fingerprint of their
+// archive and their path in it - each file is stored under its original name in its
+// own folder, so that it can be opened directly with the default application
+//
+// the cache is limited in size and the least recently used files are evicted first,
+// and cached files are checked against the CRC or hash recorded when they were added
+// before being used, since they can be modified once opened
+//
+class ExtractionCache
+{
+public:
+
+  struct Key {
+    QString id;
+
+    // the expected CRC-32 of the file, if known
+    std::optional<std::uint32_t> crc;
+  };
+
+public:
+
+  /**
+   * @brief Create the key of a file from its content.
+   */
+  static Key contentKey(std::uint32_t crc, std::uint64_t size);
+
+  /**
+   * @brief Create the key of a file from its archive and path.
+   *
+   * @param fingerprint Fingerprint of the archive, see fingerprint().
+   * @param path Path of the file in the archive.
+   */
+  static Key entryKey(QString const& fingerprint, QString const& path);
+
+  /**
+   * @brief Compute the fingerprint of the given archive, from its path, size and
+   *     modification time.
+   */
+  static QString fingerprint(QString const& archivePath);
+
+  /**
+   * @brief Compute the CRC-32 of the given file.
+   *
+   * @return the CRC, or nothing if the file cannot be read.
+   */
+  static std::optional<std::uint32_t> crc32(QString const& path);
+
+public:
+
+  /**
+   * @brief Open the cache in the given directory, which is created if needed.
+   *
+   * @param directory Directory of the cache.
+   * @param capacity Maximum total size of the cached files, in bytes.
+   */
+  ExtractionCache(QString directory, std::uint64_t capacity);
+
+  /**
+   * @brief Save the last use of the files retrieved since the manifest was last
+   *     written.
+   */
+  ~ExtractionCache();
+
+  /**
+   * @brief Retrieve the cached copy of the given file, after checking its integrity.
+   *
+   * @return the path to the cached copy, or an empty string if the file is not
+   *     cached or if the cached copy has been modified.
+   */
+  QString find(Key const& key);
+
+  /**
+   * @brief Add a copy of the given extracted file to the cache.
+   *
+   * @param key Key of the file.
+   * @param name Name of the file, the copy has the same name.
+   * @param path Path of the extracted file.
+   *
+   * @return the path to the cached copy, or an empty string if the file could not
+   *     be added (e.g. it is larger than the cache, or does not match its CRC).
+   */
+  QString insert(Key const& key, QString const& name, QString const& path);
+
+private:
+
+  struct Item {
+    QString name;
+    std::uint64_t size;
+
+    // the CRC-32 of the file, computed when it was added
+    std::uint32_t crc;
+
+    // last use, in milliseconds since the epoch
+    qint64 used;
+  };
+
+  // the folder holding the file with the given key
+  //
+  QString folder(QString const& id) const;
+
+  // remove the file with the given key, the file is only forgotten if its folder
+  // could be removed, so that it is not left on disk without being accounted for
+  //
+  bool remove(QString const& id);
+
+  // evict the least recently used files until the given number of bytes can be
+  // added, files that cannot be removed (e.g. opened) are skipped
+  //
+  void evict(std::uint64_t incoming);
+
+  // load the manifest and remove the folders it does not know about, e.g. left
+  // by a previous session that could not remove them
+  //
+  void load();
+  void save();
+
+  const QString m_Directory;
+  const std::uint64_t m_Capacity;
+
+  std::map<QString, Item> m_Items;
+  std::uint64_t m_Size = 0;
+
+  // whether the manifest must be written, the last use of the files retrieved
+  // is only saved with the next change or when the cache is destroyed
+  bool m_Dirty = false;
+
+};
+
+#endif // EXTRACTIONCACHE_H
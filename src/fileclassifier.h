@@ -0,0 +1,255 @@
+/*
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This file is part of Mod Organizer.
+
+Mod Organizer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Mod Organizer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Mod Organizer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#ifndef FILECLASSIFIER_H
+#define FILECLASSIFIER_H
+
+#include <array>
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
+
+#include <QString>
+
+// category of a file, from its extension
+//
+enum class FileCategory : std::uint8_t {
+  OTHER,
+  TEXTURE,
+  IMAGE,
+  MESH,
+  ANIMATION,
+  PLUGIN,
+  ARCHIVE,
+  SCRIPT,
+  SCRIPT_SOURCE,
+  INTERFACE,
+  AUDIO,
+  VIDEO,
+  CONFIG,
+  DOCUMENT,
+  EXECUTABLE,
+  COUNT
+};
+
+// keys of file extensions, and perfect hash table of the known extensions of game
+// assets, generated at compile-time - see FileClassifier
+//
+// extensions are packed into 64-bit keys (6 bits per character, case-insensitive, up
+// to 10 characters), and the table maps keys to slots with a single multiplication
+//
+class FileExtensionTable {
+public:
+
+  using Key = std::uint64_t;
+
+  // the key of extensions that cannot be in the table
+  //
+  static constexpr Key NO_KEY = 0;
+
+  static constexpr std::size_t MAX_LENGTH = 10;
+
+  // 1024 slots keep the table small (9 KB) while a collision-free multiplier is
+  // found after a few attempts for ~70 extensions
+  //
+  static constexpr int BITS = 10;
+  static constexpr std::size_t SIZE = std::size_t(1) << BITS;
+
+  struct Table {
+    Key multiplier;
+    std::array<Key, SIZE> keys;
+    std::array<FileCategory, SIZE> categories;
+  };
+
+public:
+
+  // the key of the given extension, without the leading dot, or NO_KEY if the
+  // extension is empty, too long or contains anything else than ASCII letters and
+  // digits
+  //
+  template <class Char>
+  static constexpr Key key(std::basic_string_view<Char> extension) {
+    if (extension.empty() || extension.size() > MAX_LENGTH) {
+      return NO_KEY;
+    }
+    Key key = 0;
+    for (Char c : extension) {
+      const auto code = static_cast<std::uint32_t>(static_cast<std::make_unsigned_t<Char>>(c));
+      Key value = 0;
+      if (code >= 'a' && code <= 'z') {
+        value = code - 'a' + 1;
+      }
+      else if (code >= 'A' && code <= 'Z') {
+        value = code - 'A' + 1;
+      }
+      else if (code >= '0' && code <= '9') {
+        value = code - '0' + 27;
+      }
+      else {
+        return NO_KEY;
+      }
+      key = (key << 6) | value;
+    }
+    return key;
+  }
+
+  static constexpr std::size_t slot(Key key, Key multiplier) {
+    return static_cast<std::size_t>((key * multiplier) >> (64 - BITS));
+  }
+
+  // try multipliers from a fixed pseudo-random sequence until one maps all the
+  // extensions to distinct slots, this fails to compile if none is found
+  //
+  static constexpr Table build() {
+    Key multiplier = 0x9E3779B97F4A7C15ull;
+    for (int attempt = 0; attempt < 1000; ++attempt) {
+      Table table{ multiplier, {}, {} };
+      bool collision = false;
+      for (auto const& entry : ENTRIES) {
+        const Key k = key(std::string_view(entry.extension));
+        const std::size_t i = slot(k, multiplier);
+        if (table.keys[i] != NO_KEY) {
+          collision = true;
+          break;
+        }
+        table.keys[i] = k;
+        table.categories[i] = entry.category;
+      }
+      if (!collision) {
+        return table;
+      }
+      multiplier = (multiplier * 6364136223846793005ull + 1442695040888963407ull) | 1;
+    }
+    throw "no perfect hash found for the extensions";
+  }
+
+private:
+
+  struct Entry {
+    const char* extension;
+    FileCategory category;
+  };
+
+  static constexpr Entry ENTRIES[] = {
+    { "dds", FileCategory::TEXTURE }, { "tga", FileCategory::TEXTURE }, { "hdr", FileCategory::TEXTURE },
+    { "png", FileCategory::IMAGE }, { "jpg", FileCategory::IMAGE }, { "jpeg", FileCategory::IMAGE },
+    { "bmp", FileCategory::IMAGE }, { "gif", FileCategory::IMAGE }, { "webp", FileCategory::IMAGE },
+    { "psd", FileCategory::IMAGE }, { "xcf", FileCategory::IMAGE },
+    { "nif", FileCategory::MESH }, { "tri", FileCategory::MESH }, { "egm", FileCategory::MESH },
+    { "egt", FileCategory::MESH }, { "btr", FileCategory::MESH }, { "bto", FileCategory::MESH },
+    { "obj", FileCategory::MESH },
+    { "hkx", FileCategory::ANIMATION }, { "kf", FileCategory::ANIMATION },
+    { "esp", FileCategory::PLUGIN }, { "esm", FileCategory::PLUGIN }, { "esl", FileCategory::PLUGIN },
+    { "bsa", FileCategory::ARCHIVE }, { "ba2", FileCategory::ARCHIVE }, { "zip", FileCategory::ARCHIVE },
+    { "7z", FileCategory::ARCHIVE }, { "rar", FileCategory::ARCHIVE },
+    { "pex", FileCategory::SCRIPT }, { "lua", FileCategory::SCRIPT }, { "seq", FileCategory::SCRIPT },
+    { "psc", FileCategory::SCRIPT_SOURCE },
+    { "swf", FileCategory::INTERFACE }, { "gfx", FileCategory::INTERFACE }, { "fnt", FileCategory::INTERFACE },
+    { "ttf", FileCategory::INTERFACE }, { "otf", FileCategory::INTERFACE }, { "strings", FileCategory::INTERFACE },
+    { "dlstrings", FileCategory::INTERFACE }, { "ilstrings", FileCategory::INTERFACE },
+    { "wav", FileCategory::AUDIO }, { "xwm", FileCategory::AUDIO }, { "ogg", FileCategory::AUDIO },
+    { "mp3", FileCategory::AUDIO }, { "flac", FileCategory::AUDIO }, { "fuz", FileCategory::AUDIO },
+    { "lip", FileCategory::AUDIO },
+    { "bik", FileCategory::VIDEO }, { "bk2", FileCategory::VIDEO }, { "mp4", FileCategory::VIDEO },
+    { "webm", FileCategory::VIDEO },
+    { "ini", FileCategory::CONFIG }, { "xml", FileCategory::CONFIG }, { "json", FileCategory::CONFIG },
+    { "toml", FileCategory::CONFIG }, { "yaml", FileCategory::CONFIG }, { "yml", FileCategory::CONFIG },
+    { "cfg", FileCategory::CONFIG },
+    { "txt", FileCategory::DOCUMENT }, { "md", FileCategory::DOCUMENT }, { "pdf", FileCategory::DOCUMENT },
+    { "rtf", FileCategory::DOCUMENT }, { "html", FileCategory::DOCUMENT }, { "htm", FileCategory::DOCUMENT },
+    { "doc", FileCategory::DOCUMENT }, { "docx", FileCategory::DOCUMENT },
+    { "dll", FileCategory::EXECUTABLE }, { "exe", FileCategory::EXECUTABLE }, { "asi", FileCategory::EXECUTABLE }
+  };
+
+};
+
+// classification of files by extension, for the known extensions of game assets
+//
+// classifying a name is a backward scan to the dot, one multiplication and one
+// comparison in the table, without any allocation - keys can also be used as case
+// labels to dispatch on specific extensions
+//
+class FileClassifier {
+public:
+
+  using Key = FileExtensionTable::Key;
+
+  static constexpr Key NO_KEY = FileExtensionTable::NO_KEY;
+
+public:
+
+  // the key of the given extension, see FileExtensionTable::key()
+  //
+  static constexpr Key key(const char* extension) {
+    return FileExtensionTable::key(std::string_view(extension));
+  }
+
+  static Key key(QString const& extension) {
+    return FileExtensionTable::key(std::u16string_view(
+      reinterpret_cast<const char16_t*>(extension.utf16()), static_cast<std::size_t>(extension.size())));
+  }
+
+  // the key of the extension of the given file name
+  //
+  static Key extensionKey(QString const& name) {
+    const int dot = name.lastIndexOf('.');
+    if (dot < 0) {
+      return NO_KEY;
+    }
+    return FileExtensionTable::key(std::u16string_view(
+      reinterpret_cast<const char16_t*>(name.utf16()) + dot + 1, static_cast<std::size_t>(name.size() - dot - 1)));
+  }
+
+  // the category of the extension with the given key
+  //
+  static constexpr FileCategory classify(Key key) {
+    const std::size_t i = FileExtensionTable::slot(key, TABLE.multiplier);
+    return TABLE.keys[i] == key && key != NO_KEY ? TABLE.categories[i] : FileCategory::OTHER;
+  }
+
+  // the category of the given file name
+  //
+  static FileCategory classify(QString const& name) {
+    return classify(extensionKey(name));
+  }
+
+  // the (untranslated) name of the given category
+  //
+  static constexpr const char* name(FileCategory category) {
+    constexpr const char* names[] = {
+      "other", "texture", "image", "mesh", "animation", "plugin", "archive", "script",
+      "script source", "interface", "audio", "video", "configuration", "document",
+      "executable"
+    };
+    return names[static_cast<std::size_t>(category)];
+  }
+
+private:
+
+  static constexpr FileExtensionTable::Table TABLE = FileExtensionTable::build();
+
+};
+
+static_assert(FileClassifier::classify(FileClassifier::key("DDS")) == FileCategory::TEXTURE);
+static_assert(FileClassifier::classify(FileClassifier::key("ilstrings")) == FileCategory::INTERFACE);
+static_assert(FileClassifier::classify(FileClassifier::key("dd")) == FileCategory::OTHER);
+
+#endif // FILECLASSIFIER_H
@@ -0,0 +1,300 @@
+/*
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This file is part of Mod Organizer.
+
+Mod Organizer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Mod Organizer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Mod Organizer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "flattree.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <unordered_set>
+
+using namespace MOBase;
+
+namespace {
+
+  // maximum number of levels that are expanded sequentially to find enough
+  // subtrees for the worker threads
+  constexpr int MAX_PREFIX_DEPTH = 4;
+
+  // number of subtrees per thread, to balance the work between threads
+  constexpr std::size_t SUBTREES_PER_THREAD = 4;
+
+}
+
+// part of the image built by a single thread, with local indices
+//
+struct FlatFileTree::Fragment {
+
+  std::vector<Index> parents;
+  std::vector<Index> subtreeEnds;
+  std::vector<Index> nameIndices;
+  std::vector<std::uint8_t> types;
+  std::vector<std::uint64_t> sizes;
+  std::vector<std::uint32_t> fileCounts;
+  std::vector<std::uint16_t> depths;
+  std::vector<const FileTreeEntry*> keys;
+
+  std::vector<QString> names;
+  std::unordered_map<QString, Index> nameLookup;
+
+  Index append(const FileTreeEntry* entry, Index parent, std::uint16_t depth) {
+    auto [it, inserted] = nameLookup.try_emplace(entry->name(), static_cast<Index>(names.size()));
+    if (inserted) {
+      names.push_back(it->first);
+    }
+
+    const Index i = static_cast<Index>(types.size());
+    parents.push_back(parent);
+    subtreeEnds.push_back(i + 1);
+    nameIndices.push_back(it->second);
+    types.push_back(entry->isDir() ? DIRECTORY : FILE);
+    sizes.push_back(0);
+    fileCounts.push_back(entry->isDir() ? 0 : 1);
+    depths.push_back(depth);
+    keys.push_back(entry);
+    return i;
+  }
+
+  // flatten the given entry and everything under it, this is where most of the
+  // time is spent, the children are the ones of the IFileTree unless a function
+  // is given
+  void flatten(std::shared_ptr<const FileTreeEntry> entry, Index parent, std::uint16_t depth,
+    SizeFunction const& sizeOf, ChildrenFunction const& children = {}) {
+    const Index i = append(entry.get(), parent, depth);
+    if (entry->isDir()) {
+      auto visit = [&](std::shared_ptr<const FileTreeEntry> const& child) {
+        const Index c = static_cast<Index>(types.size());
+        flatten(child, i, depth + 1, sizeOf, children);
+        sizes[i] += sizes[c];
+        fileCounts[i] += fileCounts[c];
+      };
+      if (children) {
+        for (auto& child : children(entry.get())) {
+          visit(child);
+        }
+      }
+      else {
+        for (auto& child : *entry->astree()) {
+          visit(child);
+        }
+      }
+    }
+    else if (sizeOf) {
+      sizes[i] = sizeOf(entry.get());
+    }
+    subtreeEnds[i] = static_cast<Index>(types.size());
+  }
+};
+
+std::shared_ptr<const FlatFileTree> FlatFileTree::build(
+  std::shared_ptr<const IFileTree> tree, SizeFunction sizeOf, int threads)
+{
+  if (threads <= 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  // expand the top levels sequentially until there are enough subtrees to keep
+  // all the threads busy, archives often have a single top-level directory
+  std::unordered_set<const FileTreeEntry*> expanded;
+  std::vector<std::shared_ptr<const FileTreeEntry>> level{ tree };
+  for (int d = 0; d < MAX_PREFIX_DEPTH; ++d) {
+    const auto dirs = std::count_if(level.begin(), level.end(), [](auto& e) { return e->isDir(); });
+    if (dirs == 0 || static_cast<std::size_t>(dirs) >= threads * SUBTREES_PER_THREAD) {
+      break;
+    }
+
+    std::vector<std::shared_ptr<const FileTreeEntry>> next;
+    for (auto& entry : level) {
+      if (entry->isDir()) {
+        expanded.insert(entry.get());
+        for (auto& child : *entry->astree()) {
+          next.push_back(child);
+        }
+      }
+    }
+    level = std::move(next);
+  }
+
+  // remaining directories are flattened in parallel, the IFileTree populates its
+  // entries under a std::call_once so traversing disjoint subtrees of a tree that
+  // is not modified is safe
+  std::vector<std::pair<std::shared_ptr<const FileTreeEntry>, std::uint16_t>> frontier;
+  {
+    std::function<void(std::shared_ptr<const FileTreeEntry>, std::uint16_t)> collect = [&](auto entry, std::uint16_t depth) {
+      if (expanded.count(entry.get())) {
+        for (auto& child : *entry->astree()) {
+          collect(child, depth + 1);
+        }
+      }
+      else if (entry->isDir()) {
+        frontier.emplace_back(entry, depth);
+      }
+    };
+    collect(tree, 0);
+  }
+
+  std::vector<Fragment> fragments(frontier.size());
+  std::atomic<std::size_t> next = 0;
+  auto worker = [&]() {
+    for (std::size_t i = next++; i < frontier.size(); i = next++) {
+      fragments[i].flatten(frontier[i].first, NO_INDEX, frontier[i].second, sizeOf);
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (int i = 1; i < std::min<int>(threads, static_cast<int>(frontier.size())); ++i) {
+    workers.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread : workers) {
+    thread.join();
+  }
+
+  // stitch the expanded levels and the fragments together, in depth-first order
+  auto image = std::make_shared<FlatFileTree>();
+  std::unordered_map<QString, Index> nameLookup;
+  std::unordered_map<const FileTreeEntry*, std::size_t> fragmentOf;
+  for (std::size_t i = 0; i < frontier.size(); ++i) {
+    fragmentOf[frontier[i].first.get()] = i;
+  }
+
+  auto nameIndex = [&](QString const& name) {
+    auto [it, inserted] = nameLookup.try_emplace(name, static_cast<Index>(image->m_Names.size()));
+    if (inserted) {
+      image->m_Names.push_back(name);
+    }
+    return it->second;
+  };
+
+  std::function<Index(std::shared_ptr<const FileTreeEntry>, Index, std::uint16_t)> stitch =
+    [&](auto entry, Index parent, std::uint16_t depth) -> Index {
+
+    const Index base = static_cast<Index>(image->m_Types.size());
+
+    auto it = fragmentOf.find(entry.get());
+    if (it != fragmentOf.end()) {
+      auto& fragment = fragments[it->second];
+
+      std::vector<Index> names(fragment.names.size());
+      for (std::size_t n = 0; n < names.size(); ++n) {
+        names[n] = nameIndex(fragment.names[n]);
+      }
+
+      for (std::size_t j = 0; j < fragment.types.size(); ++j) {
+        image->m_Parents.push_back(fragment.parents[j] == NO_INDEX ? parent : base + fragment.parents[j]);
+        image->m_SubtreeEnds.push_back(base + fragment.subtreeEnds[j]);
+        image->m_NameIndices.push_back(names[fragment.nameIndices[j]]);
+      }
+      image->m_Types.insert(image->m_Types.end(), fragment.types.begin(), fragment.types.end());
+      image->m_Sizes.insert(image->m_Sizes.end(), fragment.sizes.begin(), fragment.sizes.end());
+      image->m_FileCounts.insert(image->m_FileCounts.end(), fragment.fileCounts.begin(), fragment.fileCounts.end());
+      image->m_Depths.insert(image->m_Depths.end(), fragment.depths.begin(), fragment.depths.end());
+      image->m_Keys.insert(image->m_Keys.end(), fragment.keys.begin(), fragment.keys.end());
+
+      // release the memory of the fragment as soon as possible
+      fragment = Fragment();
+      return base;
+    }
+
+    image->m_Parents.push_back(parent);
+    image->m_SubtreeEnds.push_back(base + 1);
+    image->m_NameIndices.push_back(nameIndex(entry->name()));
+    image->m_Types.push_back(entry->isDir() ? DIRECTORY : FILE);
+    image->m_Sizes.push_back(entry->isFile() && sizeOf ? sizeOf(entry.get()) : 0);
+    image->m_FileCounts.push_back(entry->isDir() ? 0 : 1);
+    image->m_Depths.push_back(depth);
+    image->m_Keys.push_back(entry.get());
+
+    if (entry->isDir()) {
+      for (auto& child : *entry->astree()) {
+        const Index c = stitch(child, base, depth + 1);
+        image->m_Sizes[base] += image->m_Sizes[c];
+        image->m_FileCounts[base] += image->m_FileCounts[c];
+      }
+    }
+    image->m_SubtreeEnds[base] = static_cast<Index>(image->m_Types.size());
+
+    return base;
+  };
+  stitch(tree, NO_INDEX, 0);
+
+  image->index();
+  return image;
+}
+
+std::shared_ptr<const FlatFileTree> FlatFileTree::build(
+  std::shared_ptr<const FileTreeEntry> root, ChildrenFunction const& children, SizeFunction sizeOf)
+{
+  // a single fragment has the layout of the image
+  Fragment fragment;
+  fragment.flatten(root, NO_INDEX, 0, sizeOf, children);
+
+  auto image = std::make_shared<FlatFileTree>();
+  image->m_Parents = std::move(fragment.parents);
+  image->m_SubtreeEnds = std::move(fragment.subtreeEnds);
+  image->m_NameIndices = std::move(fragment.nameIndices);
+  image->m_Names = std::move(fragment.names);
+  image->m_Types = std::move(fragment.types);
+  image->m_Sizes = std::move(fragment.sizes);
+  image->m_FileCounts = std::move(fragment.fileCounts);
+  image->m_Depths = std::move(fragment.depths);
+  image->m_Keys = std::move(fragment.keys);
+
+  image->index();
+  return image;
+}
+
+void FlatFileTree::index()
+{
+  // compressed sparse rows for the children, iterating in depth-first order keeps
+  // the children in the order of the original tree
+  const std::size_t n = size();
+  m_ChildOffsets.assign(n + 1, 0);
+  for (std::size_t i = 1; i < n; ++i) {
+    m_ChildOffsets[m_Parents[i] + 1]++;
+  }
+  for (std::size_t i = 0; i < n; ++i) {
+    m_ChildOffsets[i + 1] += m_ChildOffsets[i];
+  }
+  m_Children.resize(n > 0 ? n - 1 : 0);
+  std::vector<Index> fill(m_ChildOffsets.begin(), m_ChildOffsets.end() - 1);
+  for (std::size_t i = 1; i < n; ++i) {
+    m_Children[fill[m_Parents[i]]++] = static_cast<Index>(i);
+  }
+
+  m_KeyIndices.reserve(n);
+  for (std::size_t i = 0; i < n; ++i) {
+    m_KeyIndices.emplace(m_Keys[i], static_cast<Index>(i));
+  }
+}
+
+FlatFileTree::Index FlatFileTree::find(const FileTreeEntry* key) const
+{
+  auto it = m_KeyIndices.find(key);
+  return it == m_KeyIndices.end() ? NO_INDEX : it->second;
+}
+
+QString FlatFileTree::path(Index i, QChar separator) const
+{
+  QString path;
+  for (; i != 0 && i != NO_INDEX; i = m_Parents[i]) {
+    path = path.isEmpty() ? name(i) : name(i) + separator + path;
+  }
+  return path;
+}
@@ -0,0 +1,173 @@
+/*
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This file is part of Mod Organizer.
+
+Mod Organizer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Mod Organizer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Mod Organizer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FLATTREE_H
+#define FLATTREE_H
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <QString>
+
+#include "ifiletree.h"
+
+// flattened image of a file tree, stored as contiguous arrays
+//
+// nodes are stored in depth-first (pre-)order, so the subtree of a node is the range
+// [i, subtreeEnd(i)), and the children of each node are also available in compressed
+// sparse row format: the children of i are children()[childOffsets()[i]] up to
+// children()[childOffsets()[i + 1]]
+//
+// the image is immutable once built and is meant for read-only analyses (search,
+// statistics, ...) that can run from any thread with linear memory access instead of
+// going through the IFileTree interface
+//
+// the image reflects the tree as it was when built, and is not updated when the
+// user modifies the tree, the keys can be used to map nodes to the current entries
+//
+class FlatFileTree {
+public:
+
+  using Index = std::uint32_t;
+
+  enum Type : std::uint8_t {
+    FILE = 0,
+    DIRECTORY = 1
+  };
+
+  // function used to retrieve the size of a file, must be thread-safe
+  //
+  using SizeFunction = std::function<std::uint64_t(const MOBase::FileTreeEntry*)>;
+
+  // function listing the children of a directory, used to flatten a structure that
+  // differs from the one of the IFileTree, e.g. with detached entries
+  //
+  using ChildrenFunction = std::function<
+    std::vector<std::shared_ptr<const MOBase::FileTreeEntry>>(const MOBase::FileTreeEntry*)>;
+
+  static constexpr Index NO_INDEX = static_cast<Index>(-1);
+
+public:
+
+  /**
+   * @brief Build the flat image of the given tree. The tree is traversed in parallel
+   *     and must not be modified until this returns.
+   *
+   * @param tree The tree to flatten, which is the node 0 of the image.
+   * @param sizeOf Function returning the size of a file, or an empty function if sizes
+   *     are unknown.
+   * @param threads Number of threads to use, or 0 to use the number of cores.
+   */
+  static std::shared_ptr<const FlatFileTree> build(
+    std::shared_ptr<const MOBase::IFileTree> tree, SizeFunction sizeOf = {}, int threads = 0);
+
+  /**
+   * @brief Build the flat image of the tree under the given entry, as described by
+   *     the given function, in the calling thread.
+   *
+   * @param root The root of the image, which is the node 0.
+   * @param children Function returning the children of a directory of the image.
+   * @param sizeOf Function returning the size of a file, or an empty function if sizes
+   *     are unknown.
+   */
+  static std::shared_ptr<const FlatFileTree> build(
+    std::shared_ptr<const MOBase::FileTreeEntry> root, ChildrenFunction const& children, SizeFunction sizeOf = {});
+
+public:
+
+  // number of nodes in this image, including the root
+  //
+  std::size_t size() const { return m_Types.size(); }
+
+  // structure
+  //
+  Index parent(Index i) const { return m_Parents[i]; }
+  Index subtreeEnd(Index i) const { return m_SubtreeEnds[i]; }
+  std::uint16_t depth(Index i) const { return m_Depths[i]; }
+  std::size_t childCount(Index i) const { return m_ChildOffsets[i + 1] - m_ChildOffsets[i]; }
+  Index child(Index i, std::size_t n) const { return m_Children[m_ChildOffsets[i] + n]; }
+
+  // content
+  //
+  const QString& name(Index i) const { return m_Names[m_NameIndices[i]]; }
+  Type type(Index i) const { return static_cast<Type>(m_Types[i]); }
+  bool isDir(Index i) const { return m_Types[i] == DIRECTORY; }
+  bool isFile(Index i) const { return m_Types[i] == FILE; }
+
+  // size of the file, or total size of the files under the directory
+  //
+  std::uint64_t bytes(Index i) const { return m_Sizes[i]; }
+
+  // 1 for files, number of files under the directory for directories
+  //
+  std::uint32_t fileCount(Index i) const { return m_FileCounts[i]; }
+
+  // the original entry for the given node, this is only meant to be used as a key
+  // and must never be dereferenced outside of the GUI thread
+  //
+  const MOBase::FileTreeEntry* key(Index i) const { return m_Keys[i]; }
+
+  // find the node corresponding to the given entry, or NO_INDEX
+  //
+  Index find(const MOBase::FileTreeEntry* key) const;
+
+  // the path of the given node relative to the root, i.e. its original path
+  //
+  QString path(Index i, QChar separator = '/') const;
+
+  // raw arrays, for linear passes
+  //
+  const std::vector<Index>& parents() const { return m_Parents; }
+  const std::vector<Index>& subtreeEnds() const { return m_SubtreeEnds; }
+  const std::vector<Index>& childOffsets() const { return m_ChildOffsets; }
+  const std::vector<Index>& children() const { return m_Children; }
+  const std::vector<Index>& nameIndices() const { return m_NameIndices; }
+  const std::vector<QString>& names() const { return m_Names; }
+  const std::vector<std::uint8_t>& types() const { return m_Types; }
+  const std::vector<std::uint64_t>& sizes() const { return m_Sizes; }
+  const std::vector<std::uint32_t>& fileCounts() const { return m_FileCounts; }
+  const std::vector<std::uint16_t>& depths() const { return m_Depths; }
+
+private:
+
+  struct Fragment;
+
+  // create the children arrays and the key lookup once the nodes are stored
+  void index();
+
+  std::vector<Index> m_Parents;
+  std::vector<Index> m_SubtreeEnds;
+  std::vector<Index> m_ChildOffsets;
+  std::vector<Index> m_Children;
+  std::vector<Index> m_NameIndices;
+  std::vector<QString> m_Names;
+  std::vector<std::uint8_t> m_Types;
+  std::vector<std::uint64_t> m_Sizes;
+  std::vector<std::uint32_t> m_FileCounts;
+  std::vector<std::uint16_t> m_Depths;
+  std::vector<const MOBase::FileTreeEntry*> m_Keys;
+
+  std::unordered_map<const MOBase::FileTreeEntry*, Index> m_KeyIndices;
+
+};
+
+#endif // FLATTREE_H
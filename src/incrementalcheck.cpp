@@ -0,0 +1,87 @@
+/*
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This file is part of Mod Organizer.
+
+Mod Organizer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Mod Organizer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Mod Organizer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "incrementalcheck.h"
+
+using namespace MOBase;
+
+void DataRootDelta::add(QString const& name)
+{
+  // removed then added: the entry is still there but may have changed
+  if (removed.erase(name) > 0) {
+    modified.insert(name);
+  }
+  else {
+    added.insert(name);
+  }
+}
+
+void DataRootDelta::remove(QString const& name)
+{
+  // added then removed: nothing changed
+  if (added.erase(name) == 0) {
+    modified.erase(name);
+    removed.insert(name);
+  }
+}
+
+void DataRootDelta::modify(QString const& name)
+{
+  // modifying an added entry is still an addition
+  if (added.count(name) == 0) {
+    modified.insert(name);
+  }
+}
+
+void DataRootDelta::merge(DataRootDelta const& other)
+{
+  if (reset || other.reset) {
+    clear();
+    reset = true;
+    return;
+  }
+
+  for (auto& name : other.removed) {
+    remove(name);
+  }
+  for (auto& name : other.added) {
+    add(name);
+  }
+  for (auto& name : other.modified) {
+    modify(name);
+  }
+}
+
+IncrementalCheckAdapter::IncrementalCheckAdapter(const ModDataChecker* checker) :
+  m_Checker(checker) { }
+
+ModDataChecker::CheckReturn IncrementalCheckAdapter::check(std::shared_ptr<const IFileTree> root, DataRootDelta const& delta)
+{
+  if (!m_Checker) {
+    return ModDataChecker::CheckReturn::INVALID;
+  }
+
+  if (m_Last && delta.empty()) {
+    return *m_Last;
+  }
+
+  m_Last = m_Checker->dataLooksValid(root);
+
+  return *m_Last;
+}
@@ -0,0 +1,102 @@
+/*
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This file is part of Mod Organizer.
+
+Mod Organizer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Mod Organizer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Mod Organizer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef INCREMENTALCHECK_H
+#define INCREMENTALCHECK_H
+
+#include <memory>
+#include <optional>
+#include <set>
+
+#include <QString>
+
+#include <ifiletree.h>
+#include <moddatachecker.h>
+
+// change to the content of the data root since the last validation, expressed in
+// terms of the entries directly under the data root
+//
+struct DataRootDelta {
+
+  using NameSet = std::set<QString, MOBase::FileNameComparator>;
+
+  // entries that have been added to or removed from the data root
+  NameSet added;
+  NameSet removed;
+
+  // directories under the data root whose content has changed
+  NameSet modified;
+
+  // true if the whole data root has changed (e.g. a new data root has been set),
+  // in which case the other fields are meaningless
+  bool reset = false;
+
+  bool empty() const {
+    return !reset && added.empty() && removed.empty() && modified.empty();
+  }
+
+  void clear() {
+    *this = DataRootDelta();
+  }
+
+  // record changes, merging them with the existing ones
+  //
+  void add(QString const& name);
+  void remove(QString const& name);
+  void modify(QString const& name);
+
+  // merge the given delta into this one
+  //
+  void merge(DataRootDelta const& other);
+};
+
+
+// adapter used by the install dialog to validate the data root with the checker of
+// the game
+//
+// the verdict is cached and keyed by the delta since the last validation, so
+// validating without any change since then does not call the checker at all
+//
+class IncrementalCheckAdapter {
+public:
+
+  IncrementalCheckAdapter(const MOBase::ModDataChecker* checker);
+
+  // check if there is a checker at all
+  //
+  bool hasChecker() const { return m_Checker != nullptr; }
+
+  /**
+   * @brief Validate the data root.
+   *
+   * @param root The data root.
+   * @param delta The changes since the last call.
+   *
+   * @return the verdict of the checker.
+   */
+  MOBase::ModDataChecker::CheckReturn check(std::shared_ptr<const MOBase::IFileTree> root, DataRootDelta const& delta);
+
+private:
+
+  const MOBase::ModDataChecker* m_Checker;
+  std::optional<MOBase::ModDataChecker::CheckReturn> m_Last;
+
+};
+
+#endif // INCREMENTALCHECK_H
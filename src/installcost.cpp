@@ -0,0 +1,133 @@
+/*
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This file is part of Mod Organizer.
+
+Mod Organizer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Mod Organizer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Mod Organizer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "installcost.h"
+#include "pathbuilder.h"
+
+#include <algorithm>
+
+using namespace MOBase;
+
+namespace {
+
+  // files that are not in the index are not in any block
+  constexpr std::size_t NO_BLOCK = static_cast<std::size_t>(-1);
+
+  // weight of a new measurement when updating the throughput
+  constexpr double THROUGHPUT_SMOOTHING = 0.3;
+
+}
+
+InstallCostEstimator::InstallCostEstimator(ArchiveIndex index, std::shared_ptr<const IFileTree> tree, double throughput) :
+  m_Index(std::move(index)),
+  m_Throughput(throughput > 0 ? throughput : DEFAULT_THROUGHPUT),
+  m_BlockSelected(m_Index.blocks().size(), 0)
+{
+  // without per-file information, every file is in the single solid block
+  const std::size_t defaultBlock = !m_Index.hasSizes() && !m_Index.blocks().empty() ? 0 : NO_BLOCK;
+
+  PathBuilder().forEach(tree, [&](auto const& entry, QStringView path) {
+    if (entry->isDir()) {
+      return;
+    }
+    if (auto* info = m_Index.find(path.toString())) {
+      m_Files[entry.get()] = { info->size, info->block, false };
+    }
+    else {
+      m_Files[entry.get()] = { 0, defaultBlock, false };
+    }
+  });
+}
+
+void InstallCostEstimator::clear()
+{
+  for (auto& [entry, info] : m_Files) {
+    info.selected = false;
+  }
+  std::fill(m_BlockSelected.begin(), m_BlockSelected.end(), 0);
+  m_DecompressBytes = 0;
+  m_WriteBytes = 0;
+}
+
+void InstallCostEstimator::update(const FileTreeEntry* entry, bool selected)
+{
+  auto it = m_Files.find(entry);
+  if (it == m_Files.end() || it->second.selected == selected) {
+    return;
+  }
+
+  auto& info = it->second;
+  info.selected = selected;
+
+  // a block is decompressed as soon as one of its file is selected, so we only
+  // need to update the total when the first file is selected or the last one
+  // unselected
+  if (info.block != NO_BLOCK) {
+    auto& block = m_Index.blocks()[info.block];
+    const std::uint64_t blockBytes = m_Index.hasSizes() ? block.size : block.packedSize;
+    if (selected && m_BlockSelected[info.block]++ == 0) {
+      m_DecompressBytes += blockBytes;
+    }
+    else if (!selected && --m_BlockSelected[info.block] == 0) {
+      m_DecompressBytes -= blockBytes;
+    }
+  }
+
+  if (selected) {
+    m_WriteBytes += info.size;
+  }
+  else {
+    m_WriteBytes -= info.size;
+  }
+}
+
+std::uint64_t InstallCostEstimator::fileSize(const FileTreeEntry* entry) const
+{
+  auto it = m_Files.find(entry);
+  return it == m_Files.end() ? 0 : it->second.size;
+}
+
+InstallCostEstimator::Estimate InstallCostEstimator::estimate() const
+{
+  Estimate estimate;
+  estimate.decompressBytes = m_DecompressBytes;
+  estimate.writeBytes = m_WriteBytes;
+  estimate.exact = m_Index.hasSizes();
+
+  // decompressing and writing happen at the same time, so the slowest one is
+  // the limiting factor - since we do not know the real size of opaque archives,
+  // we use the compressed size for both
+  estimate.seconds = (estimate.exact ? std::max(m_DecompressBytes, m_WriteBytes) : m_DecompressBytes) / m_Throughput;
+
+  return estimate;
+}
+
+double InstallCostEstimator::updateThroughput(double current, std::uint64_t bytes, double seconds)
+{
+  // very small measurements are mostly overhead and are not representative
+  if (seconds <= 0.05 || bytes == 0) {
+    return current;
+  }
+
+  const double measured = bytes / seconds;
+  if (current <= 0) {
+    return measured;
+  }
+  return (1 - THROUGHPUT_SMOOTHING) * current + THROUGHPUT_SMOOTHING * measured;
+}
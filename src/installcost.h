@@ -0,0 +1,122 @@
+/*
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This file is part of Mod Organizer.
+
+Mod Organizer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Mod Organizer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Mod Organizer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef INSTALLCOST_H
+#define INSTALLCOST_H
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "archiveindex.h"
+#include "ifiletree.h"
+
+// estimate the cost of installing the current selection of the install dialog
+//
+// the estimator is updated incrementally: each file is either selected or not, and
+// switching the state of a file updates the totals in constant time, so that
+// toggling an item only costs the number of files under it
+//
+class InstallCostEstimator {
+public:
+
+  struct Estimate {
+
+    // number of bytes that needs to be decompressed, for solid archives this
+    // includes all the files in the blocks containing a selected file
+    std::uint64_t decompressBytes = 0;
+
+    // number of bytes that will be written to the disk
+    std::uint64_t writeBytes = 0;
+
+    // expected duration of the installation, in seconds
+    double seconds = 0;
+
+    // true if the sizes are known, false if only the size of the archive
+    // is known (decompressBytes is then the size of the archive)
+    bool exact = false;
+  };
+
+  // default throughput, in bytes per seconds, used when no installation
+  // has been measured yet
+  //
+  static constexpr double DEFAULT_THROUGHPUT = 50.0 * 1024 * 1024;
+
+public:
+
+  /**
+   * @brief Create a new estimator for the given archive.
+   *
+   * @param index Index of the archive.
+   * @param tree The original tree of the archive, before any modification. This
+   *     is used to map the entries to the archive index, so must be given before
+   *     the user can move entries around.
+   * @param throughput The measured throughput, in bytes per second.
+   */
+  InstallCostEstimator(ArchiveIndex index, std::shared_ptr<const MOBase::IFileTree> tree, double throughput);
+
+  // unselect all the files
+  //
+  void clear();
+
+  // update the selection state of the given file
+  //
+  void update(const MOBase::FileTreeEntry* entry, bool selected);
+
+  // compute the current estimate
+  //
+  Estimate estimate() const;
+
+  // retrieve the (uncompressed) size of the given file, or 0 if the size is not
+  // known, this is thread-safe
+  //
+  std::uint64_t fileSize(const MOBase::FileTreeEntry* entry) const;
+
+  // check if the size of the individual files is known
+  //
+  bool hasSizes() const { return m_Index.hasSizes(); }
+
+  // update the given throughput (in bytes per second) with a new measurement,
+  // and return the updated value
+  //
+  static double updateThroughput(double current, std::uint64_t bytes, double seconds);
+
+private:
+
+  struct FileInfo {
+    std::uint64_t size;
+    std::size_t block;
+    bool selected;
+  };
+
+  ArchiveIndex m_Index;
+  double m_Throughput;
+
+  std::unordered_map<const MOBase::FileTreeEntry*, FileInfo> m_Files;
+
+  // number of selected files in each block
+  std::vector<std::size_t> m_BlockSelected;
+
+  std::uint64_t m_DecompressBytes = 0;
+  std::uint64_t m_WriteBytes = 0;
+
+};
+
+#endif // INSTALLCOST_H
@@ -24,19 +24,32 @@ along with Mod Organizer.  If not, see <http://www.gnu.org/licenses/>.
 #include "utility.h"
 #include "log.h"
 
+#include <algorithm>
+#include <functional>
+#include <map>
+
+#include <QAction>
 #include <QMenu>
 #include <QCompleter>
 #include <QInputDialog>
 #include <QMetaType>
 #include <QMessageBox>
+#include <QLocale>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileDialog>
 
 using namespace MOBase;
 
+// estimate of the memory used by an entry, excluding its name
+static constexpr std::size_t ENTRY_BYTES = 160;
+
 
 InstallDialog::InstallDialog(std::shared_ptr<IFileTree> tree, const GuessedValue<QString> &modName, const IPluginGame *gamePlugin, QWidget *parent)
   : TutorableDialog("InstallDialog", parent),
   ui(new Ui::InstallDialog),
   m_Checker(gamePlugin->feature<ModDataChecker>()),
+  m_CheckAdapter(m_Checker),
   m_DataFolderName(gamePlugin->dataDirectory().dirName().toLower())
 {
 
@@ -54,17 +67,103 @@ InstallDialog::InstallDialog(std::shared_ptr<IFileTree> tree, const GuessedValue
   m_Tree = ui->treeContent;
   m_TreeRoot = new ArchiveTreeWidgetItem(tree);
   m_Tree->setup(m_DataFolderName);
-  connect(m_Tree, &ArchiveTreeWidget::treeChanged, [this] { updateProblems(); });
+  m_TreeConnections.push_back(connect(m_Tree, &ArchiveTreeWidget::treeChanged, [this] { scheduleValidation(); }));
+  m_TreeConnections.push_back(connect(m_Tree, &ArchiveTreeWidget::dataRootContentChanged, [this](DataRootDelta const& delta) {
+    m_PendingDelta.merge(delta);
+  }));
+
+  m_ValidationTimer.setSingleShot(true);
+  connect(&m_ValidationTimer, &QTimer::timeout, [this] { updateProblems(); });
+
+  // the statistics only need the files whose state changed, but the panel is only
+  // refreshed once per change of the tree
+  m_TreeConnections.push_back(connect(m_Tree, &ArchiveTreeWidget::checkStateChanged, [this](ArchiveTreeWidgetItem* item) {
+    if (m_Statistics) {
+      m_Tree->forEachFile(item, [this](const FileTreeEntry* entry, bool checked) {
+        m_Statistics->setSelected(entry, checked);
+      });
+    }
+  }));
+  m_TreeConnections.push_back(connect(m_Tree, &ArchiveTreeWidget::dataRootChanged, [this] { syncStatistics(); }));
+  m_TreeConnections.push_back(connect(m_Tree, &ArchiveTreeWidget::itemsMoved, [this] { syncStatistics(); }));
+  m_TreeConnections.push_back(connect(m_Tree, &ArchiveTreeWidget::treeChanged, [this] { updateStatistics(); }));
+
+  ui->statisticsTree->setVisible(false);
+  auto* exportAction = new QAction(tr("Export..."), ui->statisticsTree);
+  connect(exportAction, &QAction::triggered, [this] { exportStatistics(); });
+  ui->statisticsTree->addAction(exportAction);
 
   m_Tree->setDataRoot(m_TreeRoot);
+  m_Tree->setDirectoryCounts(true);
 }
 
 InstallDialog::~InstallDialog()
 {
+  // the counting worker may use the cost estimator
+  m_Tree->setDirectoryCounts(false);
+
+  // the original root is not owned by the widget
+  m_Tree->releaseContent();
   delete ui;
 }
 
 
+void InstallDialog::showEvent(QShowEvent* event)
+{
+  if (m_Watchdog) {
+    const auto& metrics = m_Profile.metrics();
+    m_Watchdog->setContext(QString("'%1' profile, %2 entries, max fan-out %3, max depth %4")
+      .arg(m_Profile.name()).arg(metrics.entries).arg(metrics.maxFanout).arg(metrics.maxDepth));
+    m_Watchdog->start();
+  }
+
+  // the tree cannot be modified before the dialog is shown, so this is the last
+  // moment where the image can be built from the original tree
+  if (!m_FlatTree) {
+    QElapsedTimer timer;
+    timer.start();
+
+    StallWatchdog::Scope scope("flatten");
+    m_FlatTree = FlatFileTree::build(m_TreeRoot->entry()->astree(), sizeFunction());
+
+    log::debug("flattened {} entries in {}ms", m_FlatTree->size(), timer.elapsed());
+    m_Tree->setOriginalTree(m_FlatTree);
+
+    timer.restart();
+    m_Statistics = std::make_unique<ArchiveStatistics>(m_FlatTree);
+    syncStatistics();
+
+    log::debug("computed archive statistics in {}ms", timer.elapsed());
+  }
+
+  TutorableDialog::showEvent(event);
+}
+
+void InstallDialog::hideEvent(QHideEvent* event)
+{
+  if (m_Watchdog) {
+    m_Watchdog->stop();
+  }
+  m_Tree->scheduler().logStatistics();
+  m_Tree->memoryBudget().logUsage();
+  TutorableDialog::hideEvent(event);
+}
+
+void InstallDialog::setMemoryBudget(std::uint64_t bytes)
+{
+  m_Tree->setMemoryBudget(bytes);
+}
+
+void InstallDialog::setStallThreshold(int threshold)
+{
+  m_Watchdog = threshold > 0 ? std::make_unique<StallWatchdog>(threshold) : nullptr;
+}
+
+void InstallDialog::setArchiveSource(std::shared_ptr<const ArchiveSource> source)
+{
+  m_Tree->setArchiveSource(std::move(source));
+}
+
 QString InstallDialog::getModName() const
 {
   return ui->nameCombo->currentText();
@@ -74,18 +173,189 @@ QString InstallDialog::getModName() const
  * @brief Retrieve the user-modified directory structure.
  *
  * @return the new tree represented by this dialog, which can be a new
- *     tree or a subtree of the original tree.
+ *     tree or a subtree of the original tree, or the tree returned by
+ *     finalize() once the dialog has been finalized.
  **/
 std::shared_ptr<MOBase::IFileTree> InstallDialog::getModifiedTree() const {
+  // the items have been released by finalize()
+  if (m_TreeRoot == nullptr) {
+    return m_FinalTree;
+  }
   return m_Tree->root()->entry()->astree();
 }
 
+InstallDialog::Finalization InstallDialog::finalize()
+{
+  Finalization result;
+  result.tree = getModifiedTree();
+  const FileTreeEntry* reachable = result.tree.get();
+
+  auto observe = [&result](std::shared_ptr<const FileTreeEntry> const& entry) {
+    result.unreachable.emplace_back(entry, ENTRY_BYTES + entry->name().size() * sizeof(QChar));
+  };
+
+  // entries attached under the given one, except the returned tree - directories are
+  // populated when first iterated, so only the ones of the flat image, which were
+  // all populated when it was built, are walked instead of populating the others
+  // only to count them
+  std::function<void(std::shared_ptr<const FileTreeEntry> const&)> walk = [&](auto const& entry) {
+    if (entry.get() == reachable) {
+      return;
+    }
+    observe(entry);
+    if (entry->isDir() && m_FlatTree && m_FlatTree->find(entry.get()) != FlatFileTree::NO_INDEX) {
+      for (auto& child : *entry->astree()) {
+        walk(child);
+      }
+    }
+  };
+
+  // the original tree outside of the returned one, and the entries of unchecked
+  // items, which are detached from their parent and only kept by their item
+  walk(m_TreeRoot->entry());
+  std::function<void(ArchiveTreeWidgetItem*)> walkItems = [&](ArchiveTreeWidgetItem* item) {
+    if (item->isPlaceholder()) {
+      for (auto& entry : item->pending()) {
+        if (entry->parent() == nullptr) {
+          walk(entry);
+        }
+      }
+    }
+    else if (item->entry() != nullptr && !item->isListed() && item->entry()->parent() == nullptr
+      && item->entry() != m_TreeRoot->entry()) {
+      walk(item->entry());
+    }
+    for (int i = 0; i < item->childCount(); ++i) {
+      walkItems(item->child(i));
+    }
+  };
+  walkItems(m_TreeRoot);
+  walkItems(m_Tree->root());
+
+  // the handlers of the tree use the analyses and the items released below
+  for (auto& connection : m_TreeConnections) {
+    disconnect(connection);
+  }
+  m_TreeConnections.clear();
+
+  m_ValidationTimer.stop();
+  m_Tree->setDirectoryCounts(false);
+  m_CostEstimator.reset();
+  m_Statistics.reset();
+  m_FlatTree.reset();
+
+  result.items = m_Tree->releaseContent();
+  m_TreeRoot = nullptr;
+  m_FinalTree = result.tree;
+
+  return result;
+}
+
+void InstallDialog::setCostEstimator(std::unique_ptr<InstallCostEstimator> estimator)
+{
+  m_CostEstimator = std::move(estimator);
+
+  m_TreeConnections.push_back(connect(m_Tree, &ArchiveTreeWidget::checkStateChanged, [this](ArchiveTreeWidgetItem* item) {
+    m_Tree->forEachFile(item, [this](const FileTreeEntry* entry, bool checked) {
+      m_CostEstimator->update(entry, checked);
+    });
+    updateCost();
+  }));
+  m_TreeConnections.push_back(connect(m_Tree, &ArchiveTreeWidget::dataRootChanged, [this] { resetCost(); }));
+  m_TreeConnections.push_back(connect(m_Tree, &ArchiveTreeWidget::itemsMoved, [this] { resetCost(); }));
+
+  resetCost();
+
+  // directory sizes can be shown if the size of the files is known
+  if (m_CostEstimator->hasSizes()) {
+    m_Tree->setDirectoryCounts(true, [estimator = m_CostEstimator.get()](const FileTreeEntry* entry) {
+      return estimator->fileSize(entry);
+    });
+  }
+}
+
+void InstallDialog::setProfile(InstallProfile const& profile)
+{
+  m_Profile = profile;
+
+  // paging must be set first so that eagerly populated wide directories are paged
+  m_Tree->setDepopulateCollapsed(m_Profile.depopulateCollapsed());
+  m_Tree->setPaging(m_Profile.pageThreshold(), m_Profile.pageSize());
+  if (m_Profile.eagerPopulation()) {
+    m_Tree->populateAll(m_Tree->root());
+  }
+
+  log::debug("using '{}' profile for {} entries (max fan-out: {}, max depth: {})",
+    m_Profile.name(), m_Profile.metrics().entries, m_Profile.metrics().maxFanout, m_Profile.metrics().maxDepth);
+}
+
+void InstallDialog::scheduleValidation()
+{
+  if (m_Profile.validationDelay() <= 0) {
+    updateProblems();
+  }
+  else {
+    m_ValidationTimer.start(m_Profile.validationDelay());
+  }
+}
+
+void InstallDialog::resetCost()
+{
+  if (!m_CostEstimator) {
+    return;
+  }
+
+  m_CostEstimator->clear();
+  m_Tree->forEachFile(m_Tree->root(), [this](const FileTreeEntry* entry, bool checked) {
+    m_CostEstimator->update(entry, checked);
+  });
+  updateCost();
+}
+
+void InstallDialog::updateCost()
+{
+  const auto estimate = m_CostEstimator->estimate();
+  const QLocale locale;
+
+  QString duration;
+  if (estimate.seconds < 1) {
+    duration = tr("less than a second");
+  }
+  else if (estimate.seconds < 60) {
+    duration = tr("%1s").arg(static_cast<int>(estimate.seconds + 0.5));
+  }
+  else {
+    duration = tr("%1min").arg(static_cast<int>(estimate.seconds / 60 + 0.5));
+  }
+
+  if (estimate.exact) {
+    ui->costLabel->setText(tr("%1 to write, ~%2").arg(locale.formattedDataSize(estimate.writeBytes)).arg(duration));
+    ui->costLabel->setToolTip(
+      tr("%1 will be decompressed and %2 written to the disk, which should take about %3.")
+      .arg(locale.formattedDataSize(estimate.decompressBytes))
+      .arg(locale.formattedDataSize(estimate.writeBytes))
+      .arg(duration));
+  }
+  else {
+    ui->costLabel->setText(tr("~%1").arg(duration));
+    ui->costLabel->setToolTip(
+      tr("The size of the files in this archive is unknown, the whole archive (%1) will be decompressed, which should take about %2.")
+      .arg(locale.formattedDataSize(estimate.decompressBytes))
+      .arg(duration));
+  }
+}
+
 bool InstallDialog::testForProblem()
 {
   if (!m_Checker) {
     return true;
   }
-  return m_Checker->dataLooksValid(m_Tree->root()->entry()->astree()) == ModDataChecker::CheckReturn::VALID;
+  StallWatchdog::Scope scope("validate", m_PendingDelta.reset ? QString("full") :
+    QString("%1 added, %2 removed, %3 modified").arg(m_PendingDelta.added.size())
+      .arg(m_PendingDelta.removed.size()).arg(m_PendingDelta.modified.size()));
+  auto result = m_CheckAdapter.check(m_Tree->root()->entry()->astree(), m_PendingDelta);
+  m_PendingDelta.clear();
+  return result == ModDataChecker::CheckReturn::VALID;
 }
 
 void InstallDialog::updateProblems()
@@ -143,14 +413,45 @@ void InstallDialog::createDirectoryUnder(ArchiveTreeWidgetItem* item)
 void InstallDialog::on_treeContent_customContextMenuRequested(QPoint pos)
 {
   ArchiveTreeWidgetItem* selectedItem = static_cast<ArchiveTreeWidgetItem*>(m_Tree->itemAt(pos));
-  if (selectedItem == nullptr) {
+  // content listed from nested archives cannot be acted on
+  if (selectedItem == nullptr || selectedItem->isListed()) {
     return;
   }
 
   QMenu menu;
 
+  // placeholders of paged directories have no entry
+  if (selectedItem->isPlaceholder()) {
+    const std::size_t pageSize = m_Tree->pageSize();
+    menu.addAction(tr("Show next %1 entries").arg(QLocale().toString(static_cast<qulonglong>(pageSize))),
+      [this, selectedItem, pageSize]() { m_Tree->showPending(selectedItem, pageSize); });
+    menu.addAction(tr("Show all entries"), [this, selectedItem]() {
+      m_Tree->showPending(selectedItem, selectedItem->pending().size());
+    });
+    menu.exec(m_Tree->mapToGlobal(pos));
+    return;
+  }
+
   if (selectedItem != m_Tree->root() && selectedItem->entry()->isDir()) {
     menu.addAction(tr("Set as <%1> directory").arg(m_DataFolderName), [this, selectedItem]() { m_Tree->setDataRoot(selectedItem); });
+
+    // several selected folders can be merged into a single data root
+    std::vector<ArchiveTreeWidgetItem*> folders;
+    if (selectedItem->isSelected()) {
+      m_Tree->forEachSelected([&](ArchiveTreeWidgetItem* item) {
+        if (item == m_Tree->root() || !item->isDirectory()) {
+          folders.clear();
+          return false;
+        }
+        folders.push_back(item);
+        return true;
+      });
+    }
+    if (folders.size() > 1) {
+      // the content is merged into the folder that was clicked
+      std::iter_swap(folders.begin(), std::find(folders.begin(), folders.end(), selectedItem));
+      menu.addAction(tr("Merge selected as <%1> directory").arg(m_DataFolderName), [this, folders]() { m_Tree->setDataRoots(folders); });
+    }
   }
 
   if (m_Tree->root()->entry() != m_TreeRoot->entry()) {
@@ -170,12 +471,192 @@ void InstallDialog::on_treeContent_customContextMenuRequested(QPoint pos)
       emit openFile(selectedItem->entry().get());
     });
   }
+
+  // bulk actions on the selection, the selection is not expanded into a list
+  // of items so this is cheap even for huge selections
+  if (selectedItem->isSelected()) {
+    menu.addSeparator();
+    menu.addAction(tr("Check selected"), [this]() { m_Tree->setSelectedCheckState(Qt::Checked); });
+    menu.addAction(tr("Uncheck selected"), [this]() { m_Tree->setSelectedCheckState(Qt::Unchecked); });
+  }
+  else if (selectedItem->isDirectory() && !m_Tree->selectionModel()->selection().isEmpty()) {
+    menu.addSeparator();
+    menu.addAction(tr("Move selected here"), [this, selectedItem]() { m_Tree->moveSelected(selectedItem); });
+  }
+
+  // selection by predicates over the whole current content of the folder, evaluated
+  // on a flat image of the folder built when the action is triggered
+  auto* folder = selectedItem->isDirectory() ? selectedItem : selectedItem->parent();
+  if (folder != nullptr && folder->isDirectory() && !folder->isListed()) {
+    const QString folderName = folder == m_Tree->root() ? QString("<%1>").arg(m_DataFolderName) : folder->entry()->name();
+    QMenu* selectMenu = menu.addMenu(tr("Select in '%1'").arg(folderName));
+    selectMenu->addAction(tr("Files matching..."), [this, folder]() {
+      bool ok = false;
+      const QString patterns = QInputDialog::getText(this, tr("Select files"),
+        tr("Patterns, e.g. \"*.psd *.xcf\", \"psd, xcf\" or \"textures/*.dds\":"), QLineEdit::Normal, m_SelectionPatterns, &ok);
+      if (ok && !patterns.trimmed().isEmpty()) {
+        m_SelectionPatterns = patterns;
+        auto image = m_Tree->currentImage(folder, sizeFunction());
+        applySelection(*image, SelectionQuery().patterns(patterns).evaluate(*image), false);
+      }
+    });
+    selectMenu->addAction(tr("Files larger than..."), [this, folder]() {
+      bool ok = false;
+      const double size = QInputDialog::getDouble(this, tr("Select files"),
+        tr("Minimum size (MB):"), 50, 0, 1024 * 1024, 1, &ok);
+      if (ok) {
+        const auto bytes = static_cast<std::uint64_t>(size * 1024 * 1024);
+        auto image = m_Tree->currentImage(folder, sizeFunction());
+        applySelection(*image, SelectionQuery().sizes(bytes).evaluate(*image), false);
+      }
+    });
+    selectMenu->addAction(tr("Invert selection"), [this, folder]() {
+      auto image = m_Tree->currentImage(folder);
+
+      // selected folders include all their content
+      std::vector<FlatFileTree::Index> nodes;
+      for (auto* entry : m_Tree->selectedEntries()) {
+        const auto node = image->find(entry);
+        if (node != FlatFileTree::NO_INDEX) {
+          nodes.push_back(node);
+        }
+      }
+      auto set = SelectionQuery::nodes(*image, nodes, true);
+      SelectionQuery::invert(*image, set, 0);
+      applySelection(*image, set, true);
+    });
+  }
+
   menu.exec(m_Tree->mapToGlobal(pos));
 }
 
 
+FlatFileTree::SizeFunction InstallDialog::sizeFunction() const
+{
+  if (!m_CostEstimator) {
+    return {};
+  }
+  return [estimator = m_CostEstimator.get()](const FileTreeEntry* entry) {
+    return estimator->fileSize(entry);
+  };
+}
+
+
+void InstallDialog::applySelection(FlatFileTree const& image, SelectionQuery::Set const& set, bool compact)
+{
+  const auto nodes = SelectionQuery::cover(image, set, 0, compact);
+  const std::size_t count = m_Tree->selectNodes(image, nodes);
+  log::debug("selected {} items for {} matching nodes", count, SelectionQuery::count(set));
+}
+
+
+void InstallDialog::syncStatistics()
+{
+  if (!m_Statistics) {
+    return;
+  }
+
+  // only the files under the data root are installed
+  m_Statistics->setAllSelected(false);
+  m_Tree->forEachFile(m_Tree->root(), [this](const FileTreeEntry* entry, bool checked) {
+    m_Statistics->setSelected(entry, checked);
+  });
+}
+
+void InstallDialog::updateStatistics()
+{
+  if (!m_Statistics || !ui->statisticsTree->isVisible()) {
+    return;
+  }
+
+  const QLocale locale;
+  auto text = [&locale](ArchiveStatistics::Totals const& selected, ArchiveStatistics::Totals const& total) {
+    return std::make_pair(
+      tr("%1 / %2").arg(locale.toString(static_cast<qulonglong>(selected.files))).arg(locale.toString(static_cast<qulonglong>(total.files))),
+      tr("%1 / %2").arg(locale.formattedDataSize(static_cast<qint64>(selected.bytes))).arg(locale.formattedDataSize(static_cast<qint64>(total.bytes))));
+  };
+
+  auto* tree = ui->statisticsTree;
+  tree->setUpdatesEnabled(false);
+
+  // keep the sections that were expanded
+  std::map<QString, bool> expanded;
+  for (int i = 0; i < tree->topLevelItemCount(); ++i) {
+    expanded[tree->topLevelItem(i)->text(0)] = tree->topLevelItem(i)->isExpanded();
+  }
+  tree->clear();
+
+  auto addSection = [&](QString const& title, ArchiveStatistics::Group const& summary,
+                        std::vector<ArchiveStatistics::Group> groups, QString const& emptyName, bool sort) {
+    if (sort) {
+      std::sort(groups.begin(), groups.end(), [](auto const& lhs, auto const& rhs) {
+        return lhs.total.bytes != rhs.total.bytes ? lhs.total.bytes > rhs.total.bytes : lhs.total.files > rhs.total.files;
+      });
+    }
+    auto [files, size] = text(summary.selected, summary.total);
+    auto* section = new QTreeWidgetItem(tree, { title, files, size });
+    for (auto& group : groups) {
+      if (group.total.files == 0) {
+        continue;
+      }
+      auto [files, size] = text(group.selected, group.total);
+      new QTreeWidgetItem(section, { group.name.isEmpty() ? emptyName : group.name, files, size });
+    }
+    section->setExpanded(expanded[title]);
+  };
+
+  addSection(tr("Extensions"), m_Statistics->total(), m_Statistics->extensions(), tr("(none)"), true);
+  addSection(tr("Types"), m_Statistics->total(), m_Statistics->categories(), {}, true);
+  addSection(tr("Top-level folders"), m_Statistics->total(), m_Statistics->topLevelFolders(), tr("(files at the root)"), true);
+  addSection(tr("Depth"), m_Statistics->total(), m_Statistics->depths(), {}, false);
+
+  auto* fanouts = new QTreeWidgetItem(tree, { tr("Folders by number of entries") });
+  auto const& buckets = m_Statistics->fanouts();
+  for (std::size_t i = 0; i < buckets.size(); ++i) {
+    if (buckets[i] > 0) {
+      new QTreeWidgetItem(fanouts, {
+        ArchiveStatistics::fanoutLabel(i), tr("%1 folders").arg(locale.toString(static_cast<qulonglong>(buckets[i]))) });
+    }
+  }
+  fanouts->setExpanded(expanded[fanouts->text(0)]);
+
+  tree->resizeColumnToContents(0);
+  tree->setUpdatesEnabled(true);
+}
+
+void InstallDialog::exportStatistics()
+{
+  if (!m_Statistics) {
+    return;
+  }
+
+  const QString path = QFileDialog::getSaveFileName(this, tr("Export statistics"), getModName() + ".csv", tr("CSV files (*.csv)"));
+  if (path.isEmpty()) {
+    return;
+  }
+
+  QFile file(path);
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Text | QIODevice::Truncate)) {
+    QMessageBox::warning(this, tr("Export failed"), tr("Failed to write '%1': %2").arg(path).arg(file.errorString()));
+    return;
+  }
+  file.write(m_Statistics->toCsv().toUtf8());
+}
+
+void InstallDialog::on_statisticsButton_toggled(bool checked)
+{
+  ui->statisticsTree->setVisible(checked);
+  updateStatistics();
+}
+
 void InstallDialog::on_okButton_clicked()
 {
+  // flush a pending validation so that the label is up-to-date
+  if (m_ValidationTimer.isActive()) {
+    m_ValidationTimer.stop();
+    updateProblems();
+  }
+
   if (!testForProblem()) {
     if (QMessageBox::question(this, tr("Continue?"),
                               tr("This mod was probably NOT set up correctly, most likely it will NOT work. "
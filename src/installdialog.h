@@ -20,7 +20,14 @@ along with Mod Organizer.  If not, see <http://www.gnu.org/licenses/>.
 #ifndef INSTALLDIALOG_H
 #define INSTALLDIALOG_H
 
+#include "archivestatistics.h"
 #include "archivetree.h"
+#include "flattree.h"
+#include "incrementalcheck.h"
+#include "installcost.h"
+#include "installprofile.h"
+#include "selectionquery.h"
+#include "stallwatchdog.h"
 #include "tutorabledialog.h"
 #include <guessedvalue.h>
 #include <ifiletree.h>
@@ -32,6 +39,7 @@ along with Mod Organizer.  If not, see <http://www.gnu.org/licenses/>.
 #include <QUuid>
 #include <QTreeWidgetItem>
 #include <QProgressDialog>
+#include <QTimer>
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
 
@@ -49,6 +57,26 @@ class InstallDialog : public MOBase::TutorableDialog
 {
     Q_OBJECT
 
+public:
+
+  /**
+   * @brief Result of the finalization of the dialog, see finalize().
+   */
+  struct Finalization {
+
+    // the modified tree, see getModifiedTree()
+    std::shared_ptr<MOBase::IFileTree> tree;
+
+    // the entries that are not reachable from the tree anymore, with an estimate of
+    // their size in bytes, they are only observed and are freed once nothing else
+    // references them - directories that have never been populated are observed
+    // without their content
+    std::vector<std::pair<std::weak_ptr<const MOBase::FileTreeEntry>, std::size_t>> unreachable;
+
+    // number of items deleted
+    std::size_t items = 0;
+  };
+
 public:
   /**
    * @brief Create a new install dialog for the given tree. The tree
@@ -74,10 +102,73 @@ public:
    * @brief Retrieve the user-modified directory structure.
    *
    * @return the new tree represented by this dialog, which can be a new
-   *     tree or a subtree of the original tree.
+   *     tree or a subtree of the original tree, or the tree returned by
+   *     finalize() once the dialog has been finalized.
    **/
   std::shared_ptr<MOBase::IFileTree> getModifiedTree() const;
 
+  /**
+   * @brief Retrieve the user-modified directory structure and release everything
+   *     else the dialog holds on the original tree: the items (including the original
+   *     root and the folders excluded by a nested data root), and the analyses of the
+   *     original tree. The dialog cannot be used afterwards.
+   *
+   * @return the modified tree and the entries that are not reachable from it.
+   */
+  Finalization finalize();
+
+  /**
+   * @brief Set the estimator used to display the cost of the installation. The
+   *     estimator is updated every time the user changes the selection.
+   *
+   * @param estimator The estimator for the archive being installed.
+   */
+  void setCostEstimator(std::unique_ptr<InstallCostEstimator> estimator);
+
+  /**
+   * @brief Set the profile selecting the strategies used by this dialog.
+   *
+   * @param profile The profile to use.
+   */
+  void setProfile(InstallProfile const& profile);
+
+  /**
+   * @brief Report stalls of the dialog longer than the given threshold to the log,
+   *     while the dialog is shown.
+   *
+   * @param threshold The threshold, in milliseconds, 0 to disable the reports.
+   */
+  void setStallThreshold(int threshold);
+
+  /**
+   * @brief Limit the memory used by the items of the tree that are not visible.
+   *
+   * @param bytes The budget, in bytes, 0 for no limit.
+   */
+  void setMemoryBudget(std::uint64_t bytes);
+
+  /**
+   * @brief Set the source of the archive being installed, used to list the content
+   *     of nested archives when they are expanded.
+   *
+   * @param source The source of the archive.
+   */
+  void setArchiveSource(std::shared_ptr<const ArchiveSource> source);
+
+  /**
+   * @brief Retrieve the flat image of the original archive tree, for read-only
+   *     analyses. The image is built when the dialog is first shown.
+   *
+   * @return the flat image, or a null pointer if the dialog has not been shown yet.
+   */
+  std::shared_ptr<const FlatFileTree> flatTree() const { return m_FlatTree; }
+
+  /**
+   * @brief Retrieve the tree widget of the dialog, used to drive the dialog in
+   *     benchmarks.
+   */
+  ArchiveTreeWidget* treeWidget() const { return m_Tree; }
+
 signals:
 
   /**
@@ -88,24 +179,53 @@ signals:
    */
   void openFile(const MOBase::FileTreeEntry *entry);
 
+protected:
+
+  void showEvent(QShowEvent* event) override;
+  void hideEvent(QHideEvent* event) override;
+
 private:
 
   bool testForProblem();
   void updateProblems();
+  void scheduleValidation();
+  void resetCost();
+  void updateCost();
   void createDirectoryUnder(ArchiveTreeWidgetItem* treeItem);
 
+  // replace the selection of the tree by the cover of the given set of nodes of the
+  // given image of the current tree
+  void applySelection(FlatFileTree const& image, SelectionQuery::Set const& set, bool compact);
+
+  // the function giving the size of the files for flat images, empty if there is
+  // no cost estimator
+  FlatFileTree::SizeFunction sizeFunction() const;
+
+  // re-synchronize the selection of the statistics with the tree, this walks the
+  // whole tree and is only used when the data root changes or items are moved
+  void syncStatistics();
+
+  // refresh the statistics panel, if it is visible
+  void updateStatistics();
+  void exportStatistics();
+
 private slots:
 
   // Automatic slots that are directly bound to the UI:
   void on_treeContent_customContextMenuRequested(QPoint pos);
   void on_cancelButton_clicked();
   void on_okButton_clicked();
+  void on_statisticsButton_toggled(bool checked);
 
 private:
   Ui::InstallDialog *ui;
 
   const ModDataChecker* m_Checker;
 
+  // validates the data root from the changes accumulated since the last validation
+  IncrementalCheckAdapter m_CheckAdapter;
+  DataRootDelta m_PendingDelta;
+
   // Name of the "data" directory:
   QString m_DataFolderName;
 
@@ -120,6 +240,30 @@ private:
   ArchiveTreeWidgetItem* m_TreeRoot;
   QLabel *m_ProblemLabel;
 
+  std::unique_ptr<InstallCostEstimator> m_CostEstimator;
+
+  // the connections to the signals of the tree, removed by finalize()
+  std::vector<QMetaObject::Connection> m_TreeConnections;
+
+  // the tree returned by finalize()
+  std::shared_ptr<MOBase::IFileTree> m_FinalTree;
+
+  // the profile and the timer used to delay the validation
+  InstallProfile m_Profile;
+  QTimer m_ValidationTimer;
+
+  // flat image of the original tree, built when the dialog is shown
+  std::shared_ptr<const FlatFileTree> m_FlatTree;
+
+  // composition of the archive, computed when the dialog is shown
+  std::unique_ptr<ArchiveStatistics> m_Statistics;
+
+  // running while the dialog is shown, if enabled
+  std::unique_ptr<StallWatchdog> m_Watchdog;
+
+  // the last patterns used to select files
+  QString m_SelectionPatterns;
+
 };
 
 #endif // INSTALLDIALOG_H
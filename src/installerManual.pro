@@ -25,11 +25,55 @@ DEFINES += INSTALLERMANUAL_LIBRARY
 
 SOURCES += installermanual.cpp \
     installdialog.cpp \
-    archivetree.cpp
+    archivetree.cpp \
+    linkinstaller.cpp \
+    archiveindex.cpp \
+    installcost.cpp \
+    treesnapshot.cpp \
+    flattree.cpp \
+    installprofile.cpp \
+    incrementalcheck.cpp \
+    directorycounts.cpp \
+    stallwatchdog.cpp \
+    archivestatistics.cpp \
+    nestedarchive.cpp \
+    installpipeline.cpp \
+    taskscheduler.cpp \
+    memorybudget.cpp \
+    extractioncache.cpp \
+    selectionquery.cpp \
+    pathbuilder.cpp
 
 HEADERS += installermanual.h \
     installdialog.h \
-    archivetree.h
+    archivetree.h \
+    linkinstaller.h \
+    archiveindex.h \
+    installcost.h \
+    treesnapshot.h \
+    flattree.h \
+    installprofile.h \
+    incrementalcheck.h \
+    directorycounts.h \
+    stallwatchdog.h \
+    archivestatistics.h \
+    nestedarchive.h \
+    installpipeline.h \
+    taskscheduler.h \
+    resultchannel.h \
+    memorybudget.h \
+    extractioncache.h \
+    selectionquery.h \
+    fileclassifier.h \
+    pathbuilder.h
+
+# qmake CONFIG+=benchmark builds a plugin that runs the dialog benchmark instead
+# of installing (see DialogBenchmark)
+benchmark {
+  DEFINES += INSTALLERMANUAL_BENCHMARK
+  SOURCES += dialogbenchmark.cpp
+  HEADERS += dialogbenchmark.h
+}
 
 include(../plugin_template.pri)
 
@@ -19,13 +19,28 @@ along with Mod Organizer.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "installermanual.h"
 #include "installdialog.h"
+#include "linkinstaller.h"
+#include "archiveindex.h"
+#ifdef INSTALLERMANUAL_BENCHMARK
+#include "dialogbenchmark.h"
+#endif
+#include "installcost.h"
+#include "installpipeline.h"
+#include "installprofile.h"
+#include "stallwatchdog.h"
 
 #include <utility.h>
 #include <iinstallationmanager.h>
 #include <iplugingame.h>
+#include <imodinterface.h>
+#include <log.h>
 
 #include <QtPlugin>
 #include <QDialog>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QStandardPaths>
 
 #include <Shellapi.h>
 
@@ -73,7 +88,48 @@ VersionInfo InstallerManual::version() const
 
 QList<PluginSetting> InstallerManual::settings() const
 {
-  return QList<PluginSetting>();
+  const InstallProfile::Thresholds defaults;
+  QList<PluginSetting> settings = {
+    PluginSetting("profile", tr("Strategies used by the installation dialog: 'auto' to select them from "
+      "the size of the archive, or one of 'small', 'large' or 'huge' to force them."), "auto"),
+    PluginSetting("large_entries", tr("Number of entries above which an archive uses the 'large' profile."),
+      static_cast<qulonglong>(defaults.largeEntries)),
+    PluginSetting("huge_entries", tr("Number of entries above which an archive uses the 'huge' profile."),
+      static_cast<qulonglong>(defaults.hugeEntries)),
+    PluginSetting("wide_fanout", tr("Number of entries in a single folder above which an archive uses at least the 'large' profile."),
+      static_cast<qulonglong>(defaults.wideFanout)),
+    PluginSetting("large_validation_delay", tr("Delay (in milliseconds) before validating the content after a change, for 'large' archives."),
+      defaults.largeValidationDelay),
+    PluginSetting("huge_validation_delay", tr("Delay (in milliseconds) before validating the content after a change, for 'huge' archives."),
+      defaults.hugeValidationDelay),
+    PluginSetting("paged_fanout", tr("Number of entries in a single folder above which the folder only shows a page of entries at a time (0 to disable)."),
+      static_cast<qulonglong>(defaults.pagedFanout)),
+    PluginSetting("page_size", tr("Number of entries shown per page in large folders."),
+      static_cast<qulonglong>(defaults.pageSize)),
+    PluginSetting("stall_threshold", tr("Duration (in milliseconds) above which the installation dialog not responding is reported in the log (0 to disable)."), 500),
+    PluginSetting("extraction_cache_size", tr("Size (in MB) of the cache of files opened from the installation dialog, kept between sessions (0 to disable)."), 64),
+    PluginSetting("memory_budget", tr("Memory (in MB) that the items of collapsed folders and nested archives can use before the least recently used ones are released (0 for no limit)."), 256)
+  };
+#ifdef INSTALLERMANUAL_BENCHMARK
+  settings.append(PluginSetting("benchmark_tree", tr("Tree used by the dialog benchmark: empty for the archive being "
+    "installed, or '<entries>:<fanout>:<depth>' for a synthetic tree."), ""));
+#endif
+  return settings;
+}
+
+InstallProfile InstallerManual::selectProfile(TreeMetrics const& metrics) const
+{
+  InstallProfile::Thresholds thresholds;
+  thresholds.largeEntries = m_MOInfo->pluginSetting(name(), "large_entries").toULongLong();
+  thresholds.hugeEntries = m_MOInfo->pluginSetting(name(), "huge_entries").toULongLong();
+  thresholds.wideFanout = m_MOInfo->pluginSetting(name(), "wide_fanout").toULongLong();
+  thresholds.largeValidationDelay = m_MOInfo->pluginSetting(name(), "large_validation_delay").toInt();
+  thresholds.hugeValidationDelay = m_MOInfo->pluginSetting(name(), "huge_validation_delay").toInt();
+  thresholds.pagedFanout = m_MOInfo->pluginSetting(name(), "paged_fanout").toULongLong();
+  thresholds.pageSize = m_MOInfo->pluginSetting(name(), "page_size").toULongLong();
+
+  return InstallProfile::select(
+    metrics, thresholds, m_MOInfo->pluginSetting(name(), "profile").toString());
 }
 
 unsigned int InstallerManual::priority() const
@@ -94,9 +150,81 @@ bool InstallerManual::isArchiveSupported(std::shared_ptr<const MOBase::IFileTree
 }
 
 
+void InstallerManual::onInstallationStart(QString const& archive, bool, IModInterface*)
+{
+  m_ArchivePath = archive;
+}
+
+
+ExtractionCache* InstallerManual::extractionCache()
+{
+  if (!m_Cache) {
+    const auto capacity = m_MOInfo->pluginSetting(name(), "extraction_cache_size").toULongLong() * 1024 * 1024;
+    if (capacity == 0) {
+      return nullptr;
+    }
+    m_Cache = std::make_unique<ExtractionCache>(
+      QDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation)).filePath("installerManual"), capacity);
+  }
+  return m_Cache.get();
+}
+
+std::optional<ExtractionCache::Key> InstallerManual::cacheKey(QString const& path) const
+{
+  if (path.isEmpty()) {
+    return std::nullopt;
+  }
+
+  // files of extracted directories change independently of their directory
+  const QFileInfo archive(m_ArchivePath);
+  if (archive.isDir()) {
+    return ExtractionCache::entryKey(ExtractionCache::fingerprint(QDir(m_ArchivePath).filePath(path)), path);
+  }
+
+  if (m_Source) {
+    if (auto* info = m_Source->index().find(path); info != nullptr && info->hasCrc) {
+      return ExtractionCache::contentKey(info->crc, info->size);
+    }
+  }
+
+  return ExtractionCache::entryKey(ExtractionCache::fingerprint(m_ArchivePath), path);
+}
+
 void InstallerManual::openFile(const FileTreeEntry *entry)
 {
-  QString tempName = manager()->extractFile(entry->shared_from_this());
+  StallWatchdog::Scope scope("openFile", entry->path());
+
+  // the entry may have been moved in the dialog, the cache uses its original path
+  QString originalPath;
+  auto* dialog = qobject_cast<InstallDialog*>(sender());
+  if (auto flatTree = dialog != nullptr ? dialog->flatTree() : nullptr) {
+    if (auto index = flatTree->find(entry); index != FlatFileTree::NO_INDEX) {
+      originalPath = flatTree->path(index);
+    }
+  }
+
+  auto* cache = extractionCache();
+  const auto key = cache != nullptr ? cacheKey(originalPath) : std::nullopt;
+
+  QString tempName = key ? cache->find(*key) : QString();
+  if (tempName.isEmpty()) {
+    QElapsedTimer timer;
+    timer.start();
+    tempName = manager()->extractFile(entry->shared_from_this());
+
+    // use the extraction to refine the throughput used by the cost estimator
+    const double throughput = InstallCostEstimator::updateThroughput(
+      m_MOInfo->persistent(name(), "throughput", 0).toDouble(),
+      QFileInfo(tempName).size(), timer.elapsed() / 1000.0);
+    m_MOInfo->setPersistent(name(), "throughput", throughput);
+
+    // the cached copy is opened so that the next session finds the same file
+    if (key) {
+      if (QString cached = cache->insert(*key, entry->name(), tempName); !cached.isEmpty()) {
+        tempName = cached;
+      }
+    }
+  }
 
   SHELLEXECUTEINFOW execInfo;
   memset(&execInfo, 0, sizeof(SHELLEXECUTEINFOW));
@@ -115,19 +243,141 @@ void InstallerManual::openFile(const FileTreeEntry *entry)
 IPluginInstaller::EInstallResult InstallerManual::install(
   GuessedValue<QString> &modName, std::shared_ptr<MOBase::IFileTree> &tree, QString&, int&)
 {
+#ifdef INSTALLERMANUAL_BENCHMARK
+  Q_UNUSED(modName);
+  return benchmark(tree);
+#else
   qDebug("offering installation dialog");
+
+  // the settings of the cache may have changed since the last installation
+  m_Cache.reset();
+
+  // the tree is only read until the dialog is shown, so the preparation stages that
+  // only read it can overlap, the index and the cost estimator are prepared in the
+  // background while the dialog is created
+  InstallPipeline pipeline("manual installation");
+
+  // the estimator must be created before the dialog is shown since it records the
+  // original location of the entries
+  struct Preparation {
+    std::unique_ptr<InstallCostEstimator> estimator;
+    std::shared_ptr<const ArchiveSource> source;
+  };
+
+  const double throughput = m_MOInfo->persistent(name(), "throughput", 0).toDouble();
+  auto index = pipeline.start("index", [path = m_ArchivePath]() { return ArchiveIndex::read(path); });
+  auto prepared = pipeline.then("estimator", std::move(index), [path = m_ArchivePath, tree, throughput](ArchiveIndex index) {
+    Preparation preparation;
+    if (index.isValid()) {
+      preparation.source = std::make_shared<ArchiveSource>(path, index);
+      preparation.estimator = std::make_unique<InstallCostEstimator>(std::move(index), tree, throughput);
+    }
+    return preparation;
+  });
+  auto metrics = pipeline.start("metrics", [tree]() { return TreeMetrics::measure(tree); });
+
+  // if the source is an already extracted directory, the original location of
+  // the entries must be recorded before the dialog modifies the tree
+  std::unique_ptr<LinkInstaller> linker;
+  if (LinkInstaller::isValidSource(m_ArchivePath)) {
+    linker = std::make_unique<LinkInstaller>(m_ArchivePath);
+    pipeline.run("sources", [&]() { linker->recordSources(tree); });
+  }
+
   InstallDialog dialog(tree, modName, m_MOInfo->managedGame(), parentWidget());
   connect(&dialog, &InstallDialog::openFile, this, &InstallerManual::openFile);
-  if (dialog.exec() == QDialog::Accepted) {
-    modName.update(dialog.getModName(), GUESS_USER);
+  dialog.setStallThreshold(m_MOInfo->pluginSetting(name(), "stall_threshold").toInt());
+  dialog.setMemoryBudget(m_MOInfo->pluginSetting(name(), "memory_budget").toULongLong() * 1024 * 1024);
 
-    // TODO probably more complicated than necessary
-    tree = dialog.getModifiedTree();
-    return IPluginInstaller::RESULT_SUCCESS;
-  } else {
+  dialog.setProfile(selectProfile(metrics.get()));
+  auto preparation = prepared.get();
+  if (preparation.estimator) {
+    dialog.setCostEstimator(std::move(preparation.estimator));
+  }
+  if (preparation.source) {
+    m_Source = preparation.source;
+    dialog.setArchiveSource(std::move(preparation.source));
+  }
+
+  // the stages capture the original tree, their futures are destroyed so that they
+  // cannot keep it alive once the dialog releases it
+  prepared = {};
+  metrics = {};
+
+  const bool accepted = pipeline.run("dialog", [&]() { return dialog.exec() == QDialog::Accepted; });
+  m_Source = nullptr;
+  if (!accepted) {
     return IPluginInstaller::RESULT_CANCELED;
   }
+
+  modName.update(dialog.getModName(), GUESS_USER);
+
+  // everything that is not reachable from the modified tree is released before the
+  // installation proceeds, the entries that are still alive after that are held by
+  // the caller
+  auto finalization = dialog.finalize();
+  tree = std::move(finalization.tree);
+
+  std::size_t released = 0;
+  std::uint64_t releasedBytes = 0;
+  for (auto& [entry, bytes] : finalization.unreachable) {
+    if (entry.expired()) {
+      ++released;
+      releasedBytes += bytes;
+    }
+  }
+  log::debug("released {} items and {} of {} unreachable entries (~{} KB)",
+    finalization.items, released, finalization.unreachable.size(), releasedBytes / 1024);
+
+  if (linker && pipeline.run("link", [&]() { return installLinked(modName, tree, *linker); })) {
+    return IPluginInstaller::RESULT_SUCCESSCANCEL;
+  }
+
+  return IPluginInstaller::RESULT_SUCCESS;
+#endif
+}
+
+bool InstallerManual::installLinked(
+  GuessedValue<QString>& modName, std::shared_ptr<const IFileTree> tree, const LinkInstaller& linker)
+{
+  QString targetDirectory = QDir(m_MOInfo->modsPath()).absoluteFilePath(modName);
+  if (QFileInfo::exists(targetDirectory) || !linker.isSameFilesystem(targetDirectory)) {
+    return false;
+  }
+
+  IModInterface* mod = m_MOInfo->createMod(modName);
+  if (mod == nullptr) {
+    return false;
+  }
+
+  auto result = linker.install(tree, mod->absolutePath());
+  if (!result.success) {
+    log::warn("failed to link '{}' into '{}', falling back to extraction", m_ArchivePath, mod->absolutePath());
+    m_MOInfo->removeMod(mod);
+    return false;
+  }
+
+  return true;
+}
+
+#ifdef INSTALLERMANUAL_BENCHMARK
+IPluginInstaller::EInstallResult InstallerManual::benchmark(std::shared_ptr<IFileTree> tree)
+{
+  const QString specification = m_MOInfo->pluginSetting(name(), "benchmark_tree").toString();
+  if (!specification.isEmpty()) {
+    tree = DialogBenchmark::synthetic(specification);
+  }
+
+  if (tree) {
+    DialogBenchmark::run(tree, m_MOInfo->managedGame(), selectProfile(TreeMetrics::measure(tree)));
+  }
+  else {
+    log::warn("invalid benchmark tree '{}'", specification);
+  }
+
+  return IPluginInstaller::RESULT_CANCELED;
 }
+#endif
 
 #if QT_VERSION < QT_VERSION_CHECK(5,0,0)
 Q_EXPORT_PLUGIN2(installerManual, InstallerManual)
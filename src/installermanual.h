@@ -20,9 +20,20 @@ along with Mod Organizer.  If not, see <http://www.gnu.org/licenses/>.
 #ifndef INSTALLERMANUAL_H
 #define INSTALLERMANUAL_H
 
+#include <memory>
+#include <optional>
+
 #include <imoinfo.h>
+#include <imodinterface.h>
 #include <iplugininstallersimple.h>
 
+#include "extractioncache.h"
+
+class ArchiveSource;
+class LinkInstaller;
+class InstallProfile;
+struct TreeMetrics;
+
 
 class InstallerManual : public MOBase::IPluginInstallerSimple
 {
@@ -48,6 +59,7 @@ public:
   virtual bool isManualInstaller() const;
 
   virtual bool isArchiveSupported(std::shared_ptr<const MOBase::IFileTree> tree) const;
+  virtual void onInstallationStart(QString const& archive, bool reinstallation, MOBase::IModInterface* currentMod);
   virtual EInstallResult install(MOBase::GuessedValue<QString> &modName, std::shared_ptr<MOBase::IFileTree> &tree,
                                  QString &version, int &modID);
 
@@ -56,6 +68,35 @@ private:
   bool isSimpleArchiveTopLayer(const std::shared_ptr<const MOBase::IFileTree> tree) const;
   std::shared_ptr<const MOBase::IFileTree> getSimpleArchiveBase(const std::shared_ptr<const MOBase::IFileTree> tree) const;
 
+  /**
+   * @brief Select the profile of the install dialog for a tree with the given metrics,
+   *     using the thresholds from the settings.
+   */
+  InstallProfile selectProfile(TreeMetrics const& metrics) const;
+
+  /**
+   * @brief Install the given tree from the on-disk source directory by linking
+   *     files into a new mod instead of extracting them.
+   *
+   * @param modName Name of the mod to create.
+   * @param tree The (modified) tree to install.
+   * @param linker The link installer, with sources recorded from the original tree.
+   *
+   * @return true if the mod has been installed, false otherwise.
+   */
+  bool installLinked(MOBase::GuessedValue<QString>& modName, std::shared_ptr<const MOBase::IFileTree> tree, const LinkInstaller& linker);
+
+#ifdef INSTALLERMANUAL_BENCHMARK
+  /**
+   * @brief Run the scripted benchmark of the dialog instead of the installation,
+   *     either for the given tree or for the synthetic tree from the settings, see
+   *     DialogBenchmark. This is only available in benchmark builds.
+   *
+   * @return RESULT_CANCELED since the benchmark modifies the tree.
+   */
+  EInstallResult benchmark(std::shared_ptr<MOBase::IFileTree> tree);
+#endif
+
 private slots:
 
   /**
@@ -67,7 +108,33 @@ private slots:
 
 private:
 
-  const MOBase::IOrganizer *m_MOInfo;
+  /**
+   * @brief Retrieve the key of the file at the given original path in the archive
+   *     being installed, for the extraction cache.
+   *
+   * @return the key, or nothing if the file cannot be cached.
+   */
+  std::optional<ExtractionCache::Key> cacheKey(QString const& path) const;
+
+  /**
+   * @brief Retrieve the extraction cache, creating it if needed.
+   *
+   * @return the cache, or a null pointer if it is disabled.
+   */
+  ExtractionCache* extractionCache();
+
+private:
+
+  MOBase::IOrganizer *m_MOInfo;
+
+  // path to the archive (or directory) being installed
+  QString m_ArchivePath;
+
+  // direct access to the archive being installed, while the dialog is shown
+  std::shared_ptr<const ArchiveSource> m_Source;
+
+  // cache of the files opened from the dialog, created on first use
+  std::unique_ptr<ExtractionCache> m_Cache;
 
 };
 
@@ -0,0 +1,85 @@
+/*
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This file is part of Mod Organizer.
+
+Mod Organizer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Mod Organizer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Mod Organizer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "installpipeline.h"
+
+#include <log.h>
+
+using namespace MOBase;
+
+InstallPipeline::InstallPipeline(QString name) :
+  m_Name(std::move(name)), m_Start(Clock::now())
+{
+}
+
+InstallPipeline::~InstallPipeline()
+{
+  finish();
+}
+
+std::size_t InstallPipeline::begin(const char* name, bool background)
+{
+  std::scoped_lock lock(m_Mutex);
+  m_Stages.push_back({ name, background, 0, 0 });
+  if (background) {
+    ++m_Running;
+  }
+  return m_Stages.size() - 1;
+}
+
+void InstallPipeline::end(std::size_t index, Clock::time_point start)
+{
+  using std::chrono::duration_cast;
+  using std::chrono::milliseconds;
+
+  const auto now = Clock::now();
+
+  std::scoped_lock lock(m_Mutex);
+  auto& stage = m_Stages[index];
+  stage.start = duration_cast<milliseconds>(start - m_Start).count();
+  stage.duration = duration_cast<milliseconds>(now - start).count();
+  if (stage.background) {
+    --m_Running;
+    m_Done.notify_all();
+  }
+}
+
+void InstallPipeline::finish()
+{
+  std::unique_lock lock(m_Mutex);
+  m_Done.wait(lock, [this] { return m_Running == 0; });
+
+  if (m_Finished) {
+    return;
+  }
+  m_Finished = true;
+
+  const auto total = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - m_Start).count();
+  log::debug("{}: {} stages in {}ms", m_Name, m_Stages.size(), total);
+  for (auto& stage : m_Stages) {
+    log::debug("  {}: {}ms at +{}ms{}", stage.name, stage.duration, stage.start, stage.background ? " (background)" : "");
+  }
+}
+
+std::vector<InstallPipeline::Stage> InstallPipeline::stages() const
+{
+  std::scoped_lock lock(m_Mutex);
+  return m_Stages;
+}
@@ -0,0 +1,150 @@
+/*
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This file is part of Mod Organizer.
+
+Mod Organizer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Mod Organizer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Mod Organizer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef INSTALLPIPELINE_H
+#define INSTALLPIPELINE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+
+#include <QString>
+
+#include "stallwatchdog.h"
+
+// the stages of an installation, run either in the calling thread or in a worker
+// thread so that independent stages overlap
+//
+// the duration of every stage is recorded, and the stages are written to the log
+// when the pipeline is finished or destroyed; stages run in the calling thread are
+// also instrumented for the stall watchdog
+//
+class InstallPipeline
+{
+public:
+
+  struct Stage {
+    const char* name;
+
+    // whether the stage ran in a worker thread
+    bool background;
+
+    // start of the stage since the start of the pipeline, and duration, in
+    // milliseconds
+    std::int64_t start;
+    std::int64_t duration;
+  };
+
+public:
+
+  // the name is only used in the log
+  //
+  explicit InstallPipeline(QString name);
+
+  // wait for the stages running in worker threads
+  //
+  ~InstallPipeline();
+
+  InstallPipeline(InstallPipeline const&) = delete;
+  InstallPipeline& operator=(InstallPipeline const&) = delete;
+
+  // start the given stage in a worker thread, the name must be a string literal
+  //
+  template <class F, class R = std::invoke_result_t<F>>
+  std::future<R> start(const char* name, F stage)
+  {
+    const auto index = begin(name, true);
+    return std::async(std::launch::async, [this, index, stage = std::move(stage)]() mutable {
+      return execute<R>(index, stage);
+    });
+  }
+
+  // start the given stage in a worker thread once the given previous stage is done,
+  // the stage is called with the result of the previous one, an exception thrown by
+  // the previous stage is forwarded without running the stage
+  //
+  template <class T, class F, class R = std::invoke_result_t<F, T>>
+  std::future<R> then(const char* name, std::future<T> previous, F stage)
+  {
+    const auto index = begin(name, true);
+    return std::async(std::launch::async,
+      [this, index, previous = std::move(previous), stage = std::move(stage)]() mutable {
+        auto bound = [&]() { return stage(previous.get()); };
+        return execute<R>(index, bound);
+      });
+  }
+
+  // run the given stage in the calling thread, the name must be a string literal
+  //
+  template <class F, class R = std::invoke_result_t<F>>
+  R run(const char* name, F&& stage)
+  {
+    StallWatchdog::Scope scope(name);
+    return execute<R>(begin(name, false), stage);
+  }
+
+  // wait for the stages running in worker threads and write the stages to the log,
+  // nothing can be started after this
+  //
+  void finish();
+
+  // the stages started so far, in the order they were started
+  //
+  std::vector<Stage> stages() const;
+
+private:
+
+  using Clock = std::chrono::steady_clock;
+
+  std::size_t begin(const char* name, bool background);
+  void end(std::size_t index, Clock::time_point start);
+
+  template <class R, class F>
+  R execute(std::size_t index, F& stage)
+  {
+    // the stage is recorded even if it throws
+    struct End {
+      InstallPipeline& pipeline;
+      std::size_t index;
+      Clock::time_point start;
+      ~End() { pipeline.end(index, start); }
+    } end{ *this, index, Clock::now() };
+
+    return stage();
+  }
+
+  const QString m_Name;
+  const Clock::time_point m_Start;
+  bool m_Finished = false;
+
+  // stages recorded so far, and number of stages running in worker threads
+  mutable std::mutex m_Mutex;
+  std::condition_variable m_Done;
+  std::vector<Stage> m_Stages;
+  std::size_t m_Running = 0;
+
+};
+
+#endif // INSTALLPIPELINE_H
@@ -0,0 +1,93 @@
+/*
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This file is part of Mod Organizer.
+
+Mod Organizer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Mod Organizer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Mod Organizer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "installprofile.h"
+
+#include <algorithm>
+#include <functional>
+
+using namespace MOBase;
+
+TreeMetrics TreeMetrics::measure(std::shared_ptr<const IFileTree> tree)
+{
+  TreeMetrics metrics;
+  std::function<void(std::shared_ptr<const IFileTree>, std::size_t)> visit = [&](auto tree, std::size_t depth) {
+    metrics.entries += tree->size();
+    metrics.maxFanout = std::max(metrics.maxFanout, tree->size());
+    if (!tree->empty()) {
+      metrics.maxDepth = std::max(metrics.maxDepth, depth);
+    }
+    for (auto& entry : *tree) {
+      if (entry->isDir()) {
+        visit(entry->astree(), depth + 1);
+      }
+    }
+  };
+  visit(tree, 1);
+  return metrics;
+}
+
+QString InstallProfile::name(Kind kind)
+{
+  switch (kind) {
+  case Kind::SMALL: return "small";
+  case Kind::LARGE: return "large";
+  case Kind::VERY_LARGE: return "huge";
+  }
+  return "small";
+}
+
+InstallProfile InstallProfile::select(TreeMetrics const& metrics, Thresholds const& thresholds, QString forced)
+{
+  InstallProfile profile;
+  profile.m_Metrics = metrics;
+
+  forced = forced.trimmed().toLower();
+  if (forced == name(Kind::SMALL)) {
+    profile.m_Kind = Kind::SMALL;
+  }
+  else if (forced == name(Kind::LARGE)) {
+    profile.m_Kind = Kind::LARGE;
+  }
+  else if (forced == name(Kind::VERY_LARGE)) {
+    profile.m_Kind = Kind::VERY_LARGE;
+  }
+  else if (metrics.entries >= thresholds.hugeEntries) {
+    profile.m_Kind = Kind::VERY_LARGE;
+  }
+  else if (metrics.entries >= thresholds.largeEntries || metrics.maxFanout >= thresholds.wideFanout) {
+    profile.m_Kind = Kind::LARGE;
+  }
+  else {
+    profile.m_Kind = Kind::SMALL;
+  }
+
+  // paging only depends on the size of the directories, it is never needed for
+  // small archives with the default thresholds since they have no wide directory
+  profile.m_PageThreshold = thresholds.pagedFanout;
+  profile.m_PageSize = thresholds.pageSize;
+
+  switch (profile.m_Kind) {
+  case Kind::SMALL: profile.m_ValidationDelay = 0; break;
+  case Kind::LARGE: profile.m_ValidationDelay = thresholds.largeValidationDelay; break;
+  case Kind::VERY_LARGE: profile.m_ValidationDelay = thresholds.hugeValidationDelay; break;
+  }
+
+  return profile;
+}
@@ -0,0 +1,145 @@
+/*
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This file is part of Mod Organizer.
+
+Mod Organizer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Mod Organizer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Mod Organizer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef INSTALLPROFILE_H
+#define INSTALLPROFILE_H
+
+#include <cstddef>
+#include <memory>
+
+#include <QString>
+
+#include "ifiletree.h"
+
+// shape of a file tree, used to select the install profile
+//
+struct TreeMetrics {
+
+  // total number of entries (files and directories), excluding the root
+  std::size_t entries = 0;
+
+  // maximum number of entries in a single directory
+  std::size_t maxFanout = 0;
+
+  // maximum depth of an entry (1 for entries directly under the root)
+  std::size_t maxDepth = 0;
+
+  // measure the given tree
+  //
+  static TreeMetrics measure(std::shared_ptr<const MOBase::IFileTree> tree);
+};
+
+
+// strategies used by the install dialog, selected from the shape of the tree
+//
+// small archives use the straightforward eager behavior, while large ones need
+// to avoid doing work proportional to the size of the tree on every change
+//
+class InstallProfile {
+public:
+
+  enum class Kind {
+    SMALL,
+    LARGE,
+    VERY_LARGE
+  };
+
+  // thresholds used to select the profile, all of them can be overridden through
+  // the plugin settings
+  //
+  struct Thresholds {
+
+    // number of entries above which the tree is considered large or huge
+    std::size_t largeEntries = 20000;
+    std::size_t hugeEntries = 200000;
+
+    // a single directory with more entries than this makes the tree at least
+    // large, whatever its total size
+    std::size_t wideFanout = 5000;
+
+    // delay before validating the tree after a change, for large and huge trees,
+    // in milliseconds
+    int largeValidationDelay = 150;
+    int hugeValidationDelay = 500;
+
+    // directories with more entries than this are paged, showing pageSize items
+    // at a time, 0 to disable paging
+    std::size_t pagedFanout = 5000;
+    std::size_t pageSize = 1000;
+  };
+
+public:
+
+  /**
+   * @brief Select the profile for a tree with the given metrics.
+   *
+   * @param metrics Metrics of the tree.
+   * @param thresholds Thresholds to use.
+   * @param forced Name of the profile to use (see name()), or "auto" (or an empty
+   *     string) to select it from the metrics.
+   */
+  static InstallProfile select(TreeMetrics const& metrics, Thresholds const& thresholds, QString forced = {});
+
+  // the name of the given kind of profile, as used in the settings
+  //
+  static QString name(Kind kind);
+
+public:
+
+  InstallProfile() = default;
+
+  Kind kind() const { return m_Kind; }
+  QString name() const { return name(m_Kind); }
+
+  // populate the whole tree when the dialog is opened, instead of populating
+  // directories when they are first expanded
+  //
+  bool eagerPopulation() const { return m_Kind == Kind::SMALL; }
+
+  // delay before validating the tree after a change, 0 to validate immediately,
+  // changes happening within the delay are merged in a single validation
+  //
+  int validationDelay() const { return m_ValidationDelay; }
+
+  // remove the items under directories that are collapsed and fully checked,
+  // they are re-created on the next expansion
+  //
+  bool depopulateCollapsed() const { return m_Kind != Kind::SMALL; }
+
+  // number of entries above which a directory is paged, and number of items per
+  // page (see ArchiveTreeWidget::setPaging())
+  //
+  std::size_t pageThreshold() const { return m_PageThreshold; }
+  std::size_t pageSize() const { return m_PageSize; }
+
+  // metrics used to select this profile
+  //
+  TreeMetrics const& metrics() const { return m_Metrics; }
+
+private:
+
+  Kind m_Kind = Kind::SMALL;
+  int m_ValidationDelay = 0;
+  std::size_t m_PageThreshold = 0;
+  std::size_t m_PageSize = 0;
+  TreeMetrics m_Metrics;
+
+};
+
+#endif // INSTALLPROFILE_H
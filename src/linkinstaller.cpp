@@ -0,0 +1,319 @@
+/*
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This file is part of Mod Organizer.
+
+Mod Organizer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Mod Organizer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Mod Organizer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "linkinstaller.h"
+#include "pathbuilder.h"
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QObject>
+
+#include <log.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace MOBase;
+
+namespace {
+
+  // a directory of the target tree, with the files it contains, this is the unit
+  // of work for the worker threads
+  struct DirectoryJob {
+    QString target;
+    std::vector<std::pair<QString, QString>> files;
+  };
+
+  // recursively collect the jobs for the given tree
+  void collectJobs(
+    std::shared_ptr<const IFileTree> tree, QString targetPath,
+    const std::unordered_map<const FileTreeEntry*, QString>& sources, QString sourceDirectory,
+    std::vector<DirectoryJob>& jobs, QStringList& errors)
+  {
+    DirectoryJob job{ targetPath, {} };
+    for (auto& entry : *tree) {
+      QString target = targetPath + "/" + entry->name();
+      if (entry->isDir()) {
+        collectJobs(entry->astree(), target, sources, sourceDirectory, jobs, errors);
+      }
+      else {
+        auto it = sources.find(entry.get());
+        if (it == sources.end()) {
+          errors.append(QObject::tr("No source recorded for '%1'.").arg(entry->path()));
+          continue;
+        }
+        job.files.emplace_back(sourceDirectory + "/" + it->second, target);
+      }
+    }
+    jobs.push_back(std::move(job));
+  }
+
+#ifndef _WIN32
+
+  // copy the content of in into out using copy_file_range, falling back to a
+  // plain read/write loop if the kernel does not support it for these files
+  bool copyRange(int in, int out, off_t size)
+  {
+    off_t remaining = size;
+    while (remaining > 0) {
+      ssize_t n = ::copy_file_range(in, nullptr, out, nullptr, remaining, 0);
+      if (n < 0) {
+        if (errno != ENOSYS && errno != EXDEV && errno != EINVAL) {
+          return false;
+        }
+        break;
+      }
+      if (n == 0) {
+        break;
+      }
+      remaining -= n;
+    }
+
+    if (remaining == 0) {
+      return true;
+    }
+
+    char buffer[1 << 16];
+    ssize_t n;
+    while ((n = ::read(in, buffer, sizeof(buffer))) > 0) {
+      if (::write(out, buffer, n) != n) {
+        return false;
+      }
+    }
+    return n == 0;
+  }
+
+#endif
+
+}
+
+LinkInstaller::LinkInstaller(QString sourceDirectory, int threads) :
+  m_SourceDirectory(QDir::cleanPath(sourceDirectory)),
+  m_Threads(threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency())) { }
+
+bool LinkInstaller::isValidSource(QString path)
+{
+  return !path.isEmpty() && QFileInfo(path).isDir();
+}
+
+bool LinkInstaller::isSameFilesystem(QString targetDirectory) const
+{
+  // the target may not exist yet, so we check its first existing ancestor
+  QFileInfo target(targetDirectory);
+  while (!target.exists() && !target.isRoot()) {
+    target = QFileInfo(target.absolutePath());
+  }
+
+#ifdef _WIN32
+  auto volumeOf = [](QString path) {
+    wchar_t volume[MAX_PATH + 1];
+    if (!::GetVolumePathNameW(QDir::toNativeSeparators(path).toStdWString().c_str(), volume, MAX_PATH + 1)) {
+      return QString();
+    }
+    return QString::fromWCharArray(volume);
+  };
+  QString source = volumeOf(m_SourceDirectory);
+  return !source.isEmpty() && source.compare(volumeOf(target.absoluteFilePath()), Qt::CaseInsensitive) == 0;
+#else
+  struct stat sourceStat, targetStat;
+  if (::stat(QFile::encodeName(m_SourceDirectory).constData(), &sourceStat) != 0
+    || ::stat(QFile::encodeName(target.absoluteFilePath()).constData(), &targetStat) != 0) {
+    return false;
+  }
+  return sourceStat.st_dev == targetStat.st_dev;
+#endif
+}
+
+void LinkInstaller::recordSources(std::shared_ptr<const IFileTree> tree)
+{
+  PathBuilder().forEach(tree, [this](auto const& entry, QStringView path) {
+    m_Sources[entry.get()] = path.toString();
+  });
+}
+
+bool LinkInstaller::materializeFile(QString source, QString target, Method& method, QString& error)
+{
+#ifdef _WIN32
+  // ReFS block cloning is not exposed through a simple API, so we only have
+  // hardlinks and copies on Windows
+  std::error_code ec;
+  std::filesystem::path sourcePath(source.toStdWString()), targetPath(target.toStdWString());
+  std::filesystem::create_hard_link(sourcePath, targetPath, ec);
+  if (!ec) {
+    method = Method::HARDLINK;
+    return true;
+  }
+  std::filesystem::copy_file(sourcePath, targetPath, ec);
+  if (!ec) {
+    method = Method::COPY;
+    return true;
+  }
+  error = QString::fromStdString(ec.message());
+  return false;
+#else
+  QByteArray sourcePath = QFile::encodeName(source), targetPath = QFile::encodeName(target);
+
+  int in = ::open(sourcePath.constData(), O_RDONLY | O_CLOEXEC);
+  if (in < 0) {
+    error = QString::fromLocal8Bit(std::strerror(errno));
+    return false;
+  }
+
+  struct stat st;
+  if (::fstat(in, &st) != 0) {
+    error = QString::fromLocal8Bit(std::strerror(errno));
+    ::close(in);
+    return false;
+  }
+
+  // reflinks first since they do not share the inode (the installed files can be
+  // modified without touching the source), then hardlinks, then copy
+  int out = ::open(targetPath.constData(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, st.st_mode & 0777);
+  if (out < 0) {
+    error = QString::fromLocal8Bit(std::strerror(errno));
+    ::close(in);
+    return false;
+  }
+
+  bool success = true;
+  if (::ioctl(out, FICLONE, in) == 0) {
+    method = Method::REFLINK;
+  }
+  else {
+    ::close(out);
+    ::unlink(targetPath.constData());
+    out = -1;
+
+    if (::link(sourcePath.constData(), targetPath.constData()) == 0) {
+      method = Method::HARDLINK;
+    }
+    else {
+      out = ::open(targetPath.constData(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, st.st_mode & 0777);
+      success = out >= 0 && copyRange(in, out, st.st_size);
+      if (success) {
+        method = Method::COPY;
+      }
+      else {
+        error = QString::fromLocal8Bit(std::strerror(errno));
+      }
+    }
+  }
+
+  if (out >= 0) {
+    ::close(out);
+  }
+  ::close(in);
+  return success;
+#endif
+}
+
+LinkInstaller::Result LinkInstaller::install(std::shared_ptr<const IFileTree> tree, QString targetDirectory) const
+{
+  Result result;
+  auto start = std::chrono::steady_clock::now();
+
+  std::vector<DirectoryJob> jobs;
+  collectJobs(tree, QDir::cleanPath(targetDirectory), m_Sources, m_SourceDirectory, jobs, result.errors);
+
+  // creating directories is cheap and must be done before any file is
+  // materialized so we do it sequentially
+  for (auto& job : jobs) {
+    if (!QDir().mkpath(job.target)) {
+      result.errors.append(QObject::tr("Failed to create directory '%1'.").arg(job.target));
+    }
+  }
+
+  if (!result.errors.isEmpty()) {
+    return result;
+  }
+
+  // each worker thread picks the next directory and materializes all of its files
+  std::atomic<std::size_t> next = 0;
+  std::mutex mutex;
+
+  auto worker = [&]() {
+    Result local;
+    for (std::size_t i = next++; i < jobs.size(); i = next++) {
+      for (auto& [source, target] : jobs[i].files) {
+        Method method;
+        QString error;
+        if (!materializeFile(source, target, method, error)) {
+          local.errors.append(QObject::tr("Failed to install '%1': %2.").arg(target).arg(error));
+          continue;
+        }
+        local.files++;
+        local.bytes += QFileInfo(target).size();
+        switch (method) {
+        case Method::REFLINK: local.reflinked++; break;
+        case Method::HARDLINK: local.hardlinked++; break;
+        case Method::COPY: local.copied++; break;
+        }
+      }
+    }
+
+    std::scoped_lock lock(mutex);
+    result.files += local.files;
+    result.bytes += local.bytes;
+    result.reflinked += local.reflinked;
+    result.hardlinked += local.hardlinked;
+    result.copied += local.copied;
+    result.errors.append(local.errors);
+  };
+
+  std::vector<std::thread> threads;
+  int nThreads = std::min<int>(m_Threads, static_cast<int>(jobs.size()));
+  for (int i = 1; i < nThreads; ++i) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  result.success = result.errors.isEmpty();
+
+  log::info("linked {} files ({} bytes) in {:.3f}s, {:.1f} MB/s (reflink: {}, hardlink: {}, copy: {})",
+    result.files, result.bytes, result.seconds, result.throughput() / (1024 * 1024),
+    result.reflinked, result.hardlinked, result.copied);
+  for (auto& error : result.errors) {
+    log::warn("{}", error);
+  }
+
+  return result;
+}
@@ -0,0 +1,130 @@
+/*
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This file is part of Mod Organizer.
+
+Mod Organizer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Mod Organizer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Mod Organizer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LINKINSTALLER_H
+#define LINKINSTALLER_H
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+
+#include <QString>
+#include <QStringList>
+
+#include "ifiletree.h"
+
+// install backend used when the source of a manual installation is an already
+// extracted directory: instead of extracting (copying) the data, the final layout
+// described by the (modified) file tree is materialized in the target directory
+// with reflinks or hardlinks, falling back to an in-kernel copy
+//
+// since the user can move entries around in the dialog, the original location of
+// each entry must be recorded (recordSources) before the tree is modified
+//
+class LinkInstaller {
+public:
+
+  // the way a file has been materialized
+  //
+  enum class Method {
+    REFLINK,
+    HARDLINK,
+    COPY
+  };
+
+  struct Result {
+
+    // true if all the files have been materialized
+    bool success = false;
+
+    // number of files and bytes materialized
+    std::size_t files = 0;
+    std::uint64_t bytes = 0;
+
+    // number of files materialized with each method
+    std::size_t reflinked = 0;
+    std::size_t hardlinked = 0;
+    std::size_t copied = 0;
+
+    // wall-clock time of the installation, in seconds
+    double seconds = 0;
+
+    // errors encountered (one per failing file or directory)
+    QStringList errors;
+
+    // throughput of the installation, in bytes per second
+    double throughput() const {
+      return seconds > 0 ? bytes / seconds : 0;
+    }
+  };
+
+public:
+
+  /**
+   * @brief Create a new installer for the given source directory.
+   *
+   * @param sourceDirectory The directory containing the extracted archive.
+   * @param threads Number of worker threads, or 0 to use the number of cores.
+   */
+  LinkInstaller(QString sourceDirectory, int threads = 0);
+
+  /**
+   * @brief Check if the given directory is a valid source for this backend, i.e.
+   *     if it is an existing directory (and not an archive).
+   */
+  static bool isValidSource(QString path);
+
+  /**
+   * @brief Check if the target directory lives on the same filesystem as the source
+   *     directory, in which case files can be linked instead of copied.
+   */
+  bool isSameFilesystem(QString targetDirectory) const;
+
+  /**
+   * @brief Record the original location of all the entries in the given tree. This
+   *     must be called before the tree is modified.
+   */
+  void recordSources(std::shared_ptr<const MOBase::IFileTree> tree);
+
+  /**
+   * @brief Materialize the given tree in the target directory.
+   *
+   * @param tree The tree to materialize, whose entries must have been recorded
+   *     through recordSources().
+   * @param targetDirectory The target directory, created if it does not exist.
+   *
+   * @return the result of the installation.
+   */
+  Result install(std::shared_ptr<const MOBase::IFileTree> tree, QString targetDirectory) const;
+
+private:
+
+  // materialize a single file, returning the method used or an error
+  //
+  static bool materializeFile(QString source, QString target, Method& method, QString& error);
+
+  QString m_SourceDirectory;
+  int m_Threads;
+
+  // original path (relative to the source directory) of each entry
+  std::unordered_map<const MOBase::FileTreeEntry*, QString> m_Sources;
+
+};
+
+#endif // LINKINSTALLER_H
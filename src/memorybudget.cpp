@@ -0,0 +1,141 @@
+/*
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This file is part of Mod Organizer.
+
+Mod Organizer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Mod Organizer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Mod Organizer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "memorybudget.h"
+
+#include <algorithm>
+
+#include <log.h>
+
+using namespace MOBase;
+
+MemoryBudget::MemoryBudget(std::uint64_t budget) : m_Budget(budget) { }
+
+int MemoryBudget::addCache(QString name, EvictFunction evict)
+{
+  m_Caches.push_back({ std::move(name), std::move(evict) });
+  return static_cast<int>(m_Caches.size()) - 1;
+}
+
+void MemoryBudget::track(int cache, Key key, std::uint64_t bytes, double cost)
+{
+  auto& c = m_Caches[cache];
+  auto [it, inserted] = c.entries.try_emplace(key, Entry{ 0, 0, 0 });
+  c.bytes -= it->second.bytes;
+  m_Bytes -= it->second.bytes;
+
+  it->second = { bytes, cost, ++m_Tick };
+  c.bytes += bytes;
+  m_Bytes += bytes;
+}
+
+void MemoryBudget::touch(int cache, Key key)
+{
+  auto& entries = m_Caches[cache].entries;
+  if (auto it = entries.find(key); it != entries.end()) {
+    it->second.lastUse = ++m_Tick;
+  }
+}
+
+void MemoryBudget::forget(int cache, Key key)
+{
+  auto& c = m_Caches[cache];
+  if (auto it = c.entries.find(key); it != c.entries.end()) {
+    c.bytes -= it->second.bytes;
+    m_Bytes -= it->second.bytes;
+    c.entries.erase(it);
+  }
+}
+
+std::vector<MemoryBudget::Key> MemoryBudget::keys(int cache) const
+{
+  std::vector<Key> keys;
+  for (auto& [key, entry] : m_Caches[cache].entries) {
+    keys.push_back(key);
+  }
+  return keys;
+}
+
+std::uint64_t MemoryBudget::enforce()
+{
+  if (m_Budget == 0 || m_Bytes <= m_Budget) {
+    return 0;
+  }
+
+  // the value of keeping an entry is its cost per byte, divided by the number of
+  // uses of other entries since its last use
+  struct Candidate {
+    int cache;
+    Key key;
+    double value;
+  };
+  std::vector<Candidate> candidates;
+  for (std::size_t i = 0; i < m_Caches.size(); ++i) {
+    for (auto& [key, entry] : m_Caches[i].entries) {
+      const double age = static_cast<double>(m_Tick - entry.lastUse + 1);
+      const double value = entry.cost / (std::max<std::uint64_t>(entry.bytes, 1) * age);
+      candidates.push_back({ static_cast<int>(i), key, value });
+    }
+  }
+  std::sort(candidates.begin(), candidates.end(), [](auto const& lhs, auto const& rhs) {
+    return lhs.value < rhs.value;
+  });
+
+  const std::uint64_t before = m_Bytes;
+  for (auto& candidate : candidates) {
+    if (m_Bytes <= m_Budget) {
+      break;
+    }
+
+    // evicting an entry can release other entries (e.g. nested ones)
+    auto& cache = m_Caches[candidate.cache];
+    if (cache.entries.count(candidate.key) == 0) {
+      continue;
+    }
+
+    if (cache.evict(candidate.key)) {
+      forget(candidate.cache, candidate.key);
+      ++cache.evicted;
+    }
+  }
+
+  if (m_Bytes > m_Budget) {
+    log::debug("memory budget exceeded: {} bytes used out of {}, no other entry can be evicted", m_Bytes, m_Budget);
+  }
+
+  return before - m_Bytes;
+}
+
+std::vector<MemoryBudget::Usage> MemoryBudget::usage() const
+{
+  std::vector<Usage> usage;
+  for (auto& cache : m_Caches) {
+    usage.push_back({ cache.name, cache.entries.size(), cache.bytes, cache.evicted });
+  }
+  return usage;
+}
+
+void MemoryBudget::logUsage() const
+{
+  log::debug("memory budget: {} bytes used out of {}", m_Bytes, m_Budget);
+  for (auto& cache : usage()) {
+    log::debug("  {}: {} entries, {} bytes, {} evicted", cache.cache, cache.entries, cache.bytes, cache.evicted);
+  }
+}
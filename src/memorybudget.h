@@ -0,0 +1,131 @@
+/*
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This file is part of Mod Organizer.
+
+Mod Organizer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Mod Organizer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Mod Organizer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef MEMORYBUDGET_H
+#define MEMORYBUDGET_H
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include <QString>
+
+// memory budget shared by the caches of the installation dialog
+//
+// caches track their entries with an estimate of their size and of the cost of
+// rebuilding them, and entries are marked as used when they are accessed - when the
+// total size exceeds the budget, the entries that are the cheapest to rebuild per
+// byte and that have not been used for the longest time are evicted first
+//
+// eviction is only performed by enforce(), so that caches are never modified while
+// they are tracking an entry, and the budget must only be used from the GUI thread
+//
+class MemoryBudget
+{
+public:
+
+  using Key = const void*;
+
+  // evict the given entry, returning false if the entry cannot be evicted now (e.g.
+  // because it is visible), the entry must be forgotten by the cache if it is evicted
+  //
+  using EvictFunction = std::function<bool(Key)>;
+
+  struct Usage {
+    QString cache;
+    std::size_t entries;
+    std::uint64_t bytes;
+    std::size_t evicted;
+  };
+
+public:
+
+  // create a budget of the given size, in bytes, 0 for no limit
+  //
+  explicit MemoryBudget(std::uint64_t budget = 0);
+
+  void setBudget(std::uint64_t budget) { m_Budget = budget; }
+  std::uint64_t budget() const { return m_Budget; }
+
+  // register a cache, returning its identifier
+  //
+  int addCache(QString name, EvictFunction evict);
+
+  // track a new entry or update an existing one, the cost is the relative cost of
+  // rebuilding the entry (e.g. the number of items to create), the entry is marked
+  // as used
+  //
+  void track(int cache, Key key, std::uint64_t bytes, double cost);
+
+  // mark the given entry as used, if it is tracked
+  //
+  void touch(int cache, Key key);
+
+  // stop tracking the given entry, when it is released by its cache
+  //
+  void forget(int cache, Key key);
+
+  // the entries of the given cache
+  //
+  std::vector<Key> keys(int cache) const;
+
+  // evict entries until the total size is within the budget, or until no entry can
+  // be evicted, returning the number of bytes freed
+  //
+  std::uint64_t enforce();
+
+  // current usage
+  //
+  std::uint64_t bytes() const { return m_Bytes; }
+  std::vector<Usage> usage() const;
+
+  // write the current usage to the log
+  //
+  void logUsage() const;
+
+private:
+
+  struct Entry {
+    std::uint64_t bytes;
+    double cost;
+    std::uint64_t lastUse;
+  };
+
+  struct Cache {
+    QString name;
+    EvictFunction evict;
+    std::map<Key, Entry> entries;
+    std::uint64_t bytes = 0;
+    std::size_t evicted = 0;
+  };
+
+  std::uint64_t m_Budget;
+  std::uint64_t m_Bytes = 0;
+
+  // incremented on every use, to order the entries by recency
+  std::uint64_t m_Tick = 0;
+
+  std::vector<Cache> m_Caches;
+
+};
+
+#endif // MEMORYBUDGET_H
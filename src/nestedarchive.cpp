@@ -0,0 +1,356 @@
+/*
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This file is part of Mod Organizer.
+
+Mod Organizer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Mod Organizer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Mod Organizer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "nestedarchive.h"
+#include "fileclassifier.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+
+namespace {
+
+  // little-endian readers over a raw buffer, the caller is responsible for
+  // checking the bounds
+  std::uint16_t read16(const char* p) {
+    auto* u = reinterpret_cast<const unsigned char*>(p);
+    return static_cast<std::uint16_t>(u[0] | (u[1] << 8));
+  }
+
+  std::uint32_t read32(const char* p) {
+    return read16(p) | (static_cast<std::uint32_t>(read16(p + 2)) << 16);
+  }
+
+  std::uint64_t read64(const char* p) {
+    return read32(p) | (static_cast<std::uint64_t>(read32(p + 4)) << 32);
+  }
+
+  // read exactly size bytes at the given offset
+  bool readAt(QIODevice& device, qint64 offset, char* data, qint64 size) {
+    return device.seek(offset) && device.read(data, size) == size;
+  }
+
+  constexpr std::uint32_t ZIP_LOCAL_HEADER_SIGNATURE = 0x04034b50;
+  constexpr int ZIP_LOCAL_HEADER_SIZE = 30;
+
+  constexpr int BSA_HEADER_SIZE = 36;
+  constexpr std::uint32_t BSA_INCLUDE_DIRECTORY_NAMES = 0x1;
+  constexpr std::uint32_t BSA_INCLUDE_FILE_NAMES = 0x2;
+  constexpr std::uint32_t BSA_SIZE_MASK = 0x3FFFFFFF;
+
+  constexpr int BA2_HEADER_SIZE = 24;
+  constexpr int BA2_GENERAL_RECORD_SIZE = 36;
+  constexpr int BA2_TEXTURE_RECORD_SIZE = 24;
+  constexpr int BA2_CHUNK_SIZE = 24;
+
+  // upper bound on the number of files, to reject corrupted headers before
+  // allocating anything
+  constexpr std::uint32_t MAX_FILES = 10'000'000;
+
+  // read-only window over a part of a file
+  class WindowDevice : public QIODevice {
+  public:
+
+    WindowDevice(QString path, qint64 offset, qint64 size) :
+      m_File(path), m_Offset(offset), m_Size(size) { }
+
+    bool open(OpenMode mode) override {
+      return m_File.open(QIODevice::ReadOnly) && QIODevice::open(mode | QIODevice::Unbuffered);
+    }
+
+    bool isSequential() const override { return false; }
+    qint64 size() const override { return m_Size; }
+
+  protected:
+
+    qint64 readData(char* data, qint64 maxSize) override {
+      const qint64 count = std::min(maxSize, m_Size - pos());
+      if (count <= 0) {
+        return 0;
+      }
+      if (!m_File.seek(m_Offset + pos())) {
+        return -1;
+      }
+      return m_File.read(data, count);
+    }
+
+    qint64 writeData(const char*, qint64) override {
+      return -1;
+    }
+
+  private:
+    QFile m_File;
+    qint64 m_Offset;
+    qint64 m_Size;
+  };
+
+}
+
+ArchiveSource::ArchiveSource(QString path, ArchiveIndex index) :
+  m_Path(path), m_Directory(QFileInfo(path).isDir()), m_Index(std::move(index)) { }
+
+std::unique_ptr<QIODevice> ArchiveSource::open(QString const& path) const
+{
+  if (m_Directory) {
+    auto file = std::make_unique<QFile>(QDir(m_Path).filePath(path));
+    if (!file->open(QIODevice::ReadOnly)) {
+      return nullptr;
+    }
+    return file;
+  }
+
+  // only files stored without compression in a ZIP archive can be read in place,
+  // the offset is only set for ZIP archives
+  auto* entry = m_Index.find(path);
+  if (entry == nullptr || !m_Index.hasSizes() || m_Index.isSolid() || entry->method != 0) {
+    return nullptr;
+  }
+
+  // the data follows the local header, whose variable fields may differ from the
+  // central directory ones
+  QFile archive(m_Path);
+  char header[ZIP_LOCAL_HEADER_SIZE];
+  if (!archive.open(QIODevice::ReadOnly)
+    || !readAt(archive, static_cast<qint64>(entry->offset), header, ZIP_LOCAL_HEADER_SIZE)
+    || read32(header) != ZIP_LOCAL_HEADER_SIGNATURE) {
+    return nullptr;
+  }
+  const qint64 offset = static_cast<qint64>(entry->offset) + ZIP_LOCAL_HEADER_SIZE + read16(header + 26) + read16(header + 28);
+
+  auto device = std::make_unique<WindowDevice>(m_Path, offset, static_cast<qint64>(entry->size));
+  if (!device->open(QIODevice::ReadOnly)) {
+    return nullptr;
+  }
+  return device;
+}
+
+bool NestedArchive::isSupported(QString const& name)
+{
+  switch (FileClassifier::extensionKey(name)) {
+  case FileClassifier::key("zip"):
+  case FileClassifier::key("bsa"):
+  case FileClassifier::key("ba2"):
+    return true;
+  default:
+    return false;
+  }
+}
+
+std::optional<std::vector<NestedArchive::File>> NestedArchive::list(QIODevice& device, QString const& name)
+{
+  std::optional<std::vector<File>> files;
+  switch (FileClassifier::extensionKey(name)) {
+  case FileClassifier::key("zip"):
+    files = listZip(device);
+    break;
+  case FileClassifier::key("bsa"):
+    files = listBsa(device);
+    break;
+  case FileClassifier::key("ba2"):
+    files = listBa2(device);
+    break;
+  }
+
+  if (files) {
+    std::sort(files->begin(), files->end(), [](auto const& lhs, auto const& rhs) {
+      return lhs.path.compare(rhs.path, Qt::CaseInsensitive) < 0;
+    });
+  }
+
+  return files;
+}
+
+std::optional<std::vector<NestedArchive::File>> NestedArchive::listZip(QIODevice& device)
+{
+  auto index = ArchiveIndex::readZip(device);
+  if (!index.isValid()) {
+    return {};
+  }
+
+  std::vector<File> files;
+  files.reserve(index.entries().size());
+  for (auto& [path, entry] : index.entries()) {
+    files.push_back({ path, entry.size });
+  }
+  return files;
+}
+
+std::optional<std::vector<NestedArchive::File>> NestedArchive::listBsa(QIODevice& device)
+{
+  char header[BSA_HEADER_SIZE];
+  if (!readAt(device, 0, header, BSA_HEADER_SIZE) || std::memcmp(header, "BSA\0", 4) != 0) {
+    return {};
+  }
+
+  const std::uint32_t version = read32(header + 4);
+  const std::uint32_t folderOffset = read32(header + 8);
+  const std::uint32_t flags = read32(header + 12);
+  const std::uint32_t folderCount = read32(header + 16);
+  const std::uint32_t fileCount = read32(header + 20);
+  const std::uint32_t fileNamesLength = read32(header + 28);
+
+  if ((version != 103 && version != 104 && version != 105) || fileCount > MAX_FILES || folderCount > fileCount) {
+    return {};
+  }
+
+  // file names are required to list anything meaningful
+  if (!(flags & BSA_INCLUDE_FILE_NAMES)) {
+    return {};
+  }
+
+  // folder records: hash, count, (padding,) offset
+  const int folderRecordSize = version == 105 ? 24 : 16;
+  QByteArray folders(static_cast<int>(folderCount) * folderRecordSize, Qt::Uninitialized);
+  if (!readAt(device, folderOffset, folders.data(), folders.size())) {
+    return {};
+  }
+
+  // the file record blocks follow the folder records, each block starting with the
+  // name of its folder
+  std::vector<File> files;
+  files.reserve(fileCount);
+  std::vector<int> folderOf;
+  folderOf.reserve(fileCount);
+  std::vector<QString> folderNames(folderCount);
+
+  qint64 offset = folderOffset + folders.size();
+  for (std::uint32_t i = 0; i < folderCount; ++i) {
+    const std::uint32_t count = read32(folders.constData() + i * folderRecordSize + 8);
+    if (files.size() + count > fileCount) {
+      return {};
+    }
+
+    if (flags & BSA_INCLUDE_DIRECTORY_NAMES) {
+      char length;
+      QByteArray name(256, Qt::Uninitialized);
+      if (!readAt(device, offset, &length, 1) || !readAt(device, offset + 1, name.data(), static_cast<unsigned char>(length))) {
+        return {};
+      }
+      name.truncate(std::max(0, static_cast<unsigned char>(length) - 1));
+      folderNames[i] = QString::fromLocal8Bit(name).replace('\\', '/');
+      offset += 1 + static_cast<unsigned char>(length);
+    }
+
+    QByteArray records(static_cast<int>(count) * 16, Qt::Uninitialized);
+    if (!readAt(device, offset, records.data(), records.size())) {
+      return {};
+    }
+    for (std::uint32_t j = 0; j < count; ++j) {
+      files.push_back({ QString(), read32(records.constData() + j * 16 + 8) & BSA_SIZE_MASK });
+      folderOf.push_back(static_cast<int>(i));
+    }
+    offset += records.size();
+  }
+
+  // the file names, in the order of the file records
+  QByteArray names(static_cast<int>(fileNamesLength), Qt::Uninitialized);
+  if (!readAt(device, offset, names.data(), names.size())) {
+    return {};
+  }
+
+  int start = 0;
+  for (std::size_t i = 0; i < files.size(); ++i) {
+    const int end = names.indexOf('\0', start);
+    if (end < 0) {
+      return {};
+    }
+    const QString name = QString::fromLocal8Bit(names.constData() + start, end - start);
+    auto const& folder = folderNames[folderOf[i]];
+    files[i].path = folder.isEmpty() || folder == "." ? name : folder + "/" + name;
+    start = end + 1;
+  }
+
+  return files;
+}
+
+std::optional<std::vector<NestedArchive::File>> NestedArchive::listBa2(QIODevice& device)
+{
+  char header[BA2_HEADER_SIZE];
+  if (!readAt(device, 0, header, BA2_HEADER_SIZE) || std::memcmp(header, "BTDX", 4) != 0) {
+    return {};
+  }
+
+  const std::uint32_t version = read32(header + 4);
+  const bool textures = std::memcmp(header + 8, "DX10", 4) == 0;
+  const std::uint32_t fileCount = read32(header + 12);
+  const std::uint64_t nameTableOffset = read64(header + 16);
+
+  if ((!textures && std::memcmp(header + 8, "GNRL", 4) != 0) || fileCount > MAX_FILES) {
+    return {};
+  }
+
+  // newer versions (Starfield) have additional fields in the header
+  qint64 offset = BA2_HEADER_SIZE + (version == 2 ? 8 : version == 3 ? 12 : 0);
+
+  std::vector<File> files(fileCount);
+  if (textures) {
+    for (auto& file : files) {
+      char record[BA2_TEXTURE_RECORD_SIZE];
+      if (!readAt(device, offset, record, BA2_TEXTURE_RECORD_SIZE)) {
+        return {};
+      }
+      const int chunks = static_cast<unsigned char>(record[13]);
+      QByteArray data(chunks * BA2_CHUNK_SIZE, Qt::Uninitialized);
+      if (!readAt(device, offset + BA2_TEXTURE_RECORD_SIZE, data.data(), data.size())) {
+        return {};
+      }
+      for (int c = 0; c < chunks; ++c) {
+        file.size += read32(data.constData() + c * BA2_CHUNK_SIZE + 12);
+      }
+      offset += BA2_TEXTURE_RECORD_SIZE + data.size();
+    }
+  }
+  else {
+    QByteArray records(static_cast<int>(fileCount) * BA2_GENERAL_RECORD_SIZE, Qt::Uninitialized);
+    if (!readAt(device, offset, records.data(), records.size())) {
+      return {};
+    }
+    for (std::uint32_t i = 0; i < fileCount; ++i) {
+      files[i].size = read32(records.constData() + i * BA2_GENERAL_RECORD_SIZE + 28);
+    }
+  }
+
+  // the name table, a length-prefixed name per file
+  const qint64 tableSize = device.size() - static_cast<qint64>(nameTableOffset);
+  if (nameTableOffset == 0 || tableSize <= 0) {
+    return {};
+  }
+  QByteArray table(static_cast<int>(std::min<qint64>(tableSize, 0x7FFFFFFF)), Qt::Uninitialized);
+  if (!readAt(device, static_cast<qint64>(nameTableOffset), table.data(), table.size())) {
+    return {};
+  }
+
+  int position = 0;
+  for (auto& file : files) {
+    if (position + 2 > table.size()) {
+      return {};
+    }
+    const int length = read16(table.constData() + position);
+    if (position + 2 + length > table.size()) {
+      return {};
+    }
+    file.path = QString::fromLocal8Bit(table.constData() + position + 2, length).replace('\\', '/');
+    position += 2 + length;
+  }
+
+  return files;
+}
@@ -0,0 +1,116 @@
+/*
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This file is part of Mod Organizer.
+
+Mod Organizer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Mod Organizer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Mod Organizer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef NESTEDARCHIVE_H
+#define NESTEDARCHIVE_H
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include <QIODevice>
+#include <QString>
+
+#include "archiveindex.h"
+
+// direct access to the files of the archive being installed, without going through
+// the installation manager
+//
+// files can only be read directly when the source is an extracted directory or when
+// they are stored uncompressed in a ZIP archive, which is the usual case for archives
+// nested in another one
+//
+class ArchiveSource {
+public:
+
+  /**
+   * @brief Create a source for the given archive or directory.
+   *
+   * @param path Path to the archive or directory.
+   * @param index Index of the archive, as read by ArchiveIndex::read(path).
+   */
+  ArchiveSource(QString path, ArchiveIndex index);
+
+  /**
+   * @brief Open the given file of the archive for reading. This is thread-safe.
+   *
+   * @param path Path of the file, relative to the root of the archive.
+   *
+   * @return the opened device, or a null pointer if the file cannot be read
+   *     without extracting it.
+   */
+  std::unique_ptr<QIODevice> open(QString const& path) const;
+
+  /**
+   * @brief Retrieve the index of the archive.
+   */
+  const ArchiveIndex& index() const { return m_Index; }
+
+private:
+
+  QString m_Path;
+  bool m_Directory;
+  ArchiveIndex m_Index;
+
+};
+
+
+// listing of the files of an archive nested in the archive being installed, read
+// from the index of the nested archive only
+//
+// ZIP archives, Bethesda archives (BSA, version 103 to 105) and Fallout 4 / Starfield
+// archives (BA2) are supported
+//
+class NestedArchive {
+public:
+
+  struct File {
+
+    // path of the file in the nested archive, with '/' as separator
+    QString path;
+
+    // size of the file, this is the stored size for compressed BSA files
+    std::uint64_t size = 0;
+  };
+
+  // check if the given file name has the extension of a supported archive
+  //
+  static bool isSupported(QString const& name);
+
+  /**
+   * @brief List the files of the nested archive in the given device.
+   *
+   * @param device The device to read, must be open and seekable.
+   * @param name Name of the nested archive, used to select the format.
+   *
+   * @return the files, sorted by path, or an empty optional if the archive could
+   *     not be read.
+   */
+  static std::optional<std::vector<File>> list(QIODevice& device, QString const& name);
+
+private:
+
+  static std::optional<std::vector<File>> listZip(QIODevice& device);
+  static std::optional<std::vector<File>> listBsa(QIODevice& device);
+  static std::optional<std::vector<File>> listBa2(QIODevice& device);
+
+};
+
+#endif // NESTEDARCHIVE_H
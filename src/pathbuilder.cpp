@@ -0,0 +1,69 @@
+/*
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This file is part of Mod Organizer.
+
+Mod Organizer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Mod Organizer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Mod Organizer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include "pathbuilder.h"
+
+#include <vector>
+
+using namespace MOBase;
+
+void PathBuilder::forEach(std::shared_ptr<const IFileTree> tree, EntryCallback const& callback)
+{
+  m_Buffer.clear();
+  walk(tree, callback);
+}
+
+void PathBuilder::walk(std::shared_ptr<const IFileTree> const& tree, EntryCallback const& callback)
+{
+  const int prefix = m_Buffer.size();
+  for (auto& entry : *tree) {
+    m_Buffer.append(entry->name());
+    callback(entry, m_Buffer);
+    if (entry->isDir()) {
+      m_Buffer.append(m_Separator);
+      walk(entry->astree(), callback);
+    }
+    m_Buffer.truncate(prefix);
+  }
+}
+
+void PathBuilder::forEach(FlatFileTree const& tree, FlatFileTree::Index root, NodeCallback const& callback)
+{
+  m_Buffer.clear();
+
+  // length of the prefix of the nodes at each depth below the root, nodes are in
+  // pre-order so the prefix of a node is always the last one set for its depth
+  const std::uint16_t base = tree.depth(root) + 1;
+  std::vector<int> prefixes(1, 0);
+
+  const FlatFileTree::Index end = tree.subtreeEnd(root);
+  for (FlatFileTree::Index i = root + 1; i < end; ++i) {
+    const std::size_t level = tree.depth(i) - base;
+    m_Buffer.truncate(prefixes[level]);
+    m_Buffer.append(tree.name(i));
+    callback(i, m_Buffer);
+    if (tree.isDir(i)) {
+      prefixes.resize(level + 2);
+      prefixes[level + 1] = m_Buffer.size() + 1;
+      m_Buffer.append(m_Separator);
+    }
+  }
+}
@@ -0,0 +1,77 @@
+/*
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This file is part of Mod Organizer.
+
+Mod Organizer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Mod Organizer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Mod Organizer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#ifndef PATHBUILDER_H
+#define PATHBUILDER_H
+
+#include <functional>
+#include <memory>
+
+#include <QString>
+#include <QStringView>
+
+#include "flattree.h"
+#include "ifiletree.h"
+
+// generation of the paths of all the entries of a tree, for operations that need
+// the path of many entries (indexing, export, ...)
+//
+// FileTreeEntry::path() walks up the parents and rebuilds the whole path for every
+// entry, the builder instead walks the tree depth-first with a single buffer: the
+// name of each entry is appended after the prefix of its parent, and the buffer is
+// truncated back to the prefix for the next sibling, so generating all the paths is
+// linear in the size of the output
+//
+// paths are relative to the root of the walk, and are only valid during the call of
+// the callback, they must be copied (toString()) to be kept
+//
+class PathBuilder {
+public:
+
+  using EntryCallback = std::function<void(std::shared_ptr<const MOBase::FileTreeEntry> const&, QStringView)>;
+  using NodeCallback = std::function<void(FlatFileTree::Index, QStringView)>;
+
+public:
+
+  explicit PathBuilder(QChar separator = '/') : m_Separator(separator) { }
+
+  // call the given function for every entry under the given tree, in depth-first
+  // order, directories are visited before their content
+  //
+  void forEach(std::shared_ptr<const MOBase::IFileTree> tree, EntryCallback const& callback);
+
+  // call the given function for every node strictly under the given node of the
+  // image, in the order of the image
+  //
+  void forEach(FlatFileTree const& tree, FlatFileTree::Index root, NodeCallback const& callback);
+
+private:
+
+  void walk(std::shared_ptr<const MOBase::IFileTree> const& tree, EntryCallback const& callback);
+
+  QChar m_Separator;
+
+  // the buffer, reused between walks
+  QString m_Buffer;
+
+};
+
+#endif // PATHBUILDER_H
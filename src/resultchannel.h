@@ -0,0 +1,178 @@
+/*
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This file is part of Mod Organizer.
+
+Mod Organizer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Mod Organizer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Mod Organizer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef RESULTCHANNEL_H
+#define RESULTCHANNEL_H
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <QElapsedTimer>
+#include <QObject>
+#include <QTimer>
+
+// channel delivering results from worker threads to the GUI thread, once per frame
+//
+// workers post (key, value) updates without locking, and the GUI thread drains all
+// the pending updates at most once per frame, updates with the same key are merged
+// so that the GUI only applies the last state of each key (e.g. of each row) - the
+// whole batch is given to the apply function at once so that it can be applied with
+// a single view update
+//
+// the channel must be created and destroyed on the GUI thread, and workers must not
+// post once the destruction has started
+//
+template <class Key, class Value>
+class ResultChannel
+{
+public:
+
+  using Batch = std::vector<std::pair<Key, Value>>;
+  using ApplyFunction = std::function<void(Batch&)>;
+  using MergeFunction = std::function<void(Value&, Value&&)>;
+
+  // duration of a frame, in milliseconds
+  static constexpr int FRAME = 16;
+
+public:
+
+  // create a channel applying the batches with the given function, the context is
+  // the object on whose thread the batches are applied, values with the same key
+  // are merged with the given function, or replaced if there is none
+  //
+  ResultChannel(QObject* context, ApplyFunction apply, MergeFunction merge = {}) :
+    m_Context(context), m_Apply(std::move(apply)), m_Merge(std::move(merge))
+  {
+    m_Timer.setSingleShot(true);
+    QObject::connect(&m_Timer, &QTimer::timeout, [this] { drain(); });
+    m_LastFrame.start();
+  }
+
+  ~ResultChannel()
+  {
+    deleteNodes(m_Head.exchange(nullptr));
+  }
+
+  ResultChannel(ResultChannel const&) = delete;
+  ResultChannel& operator=(ResultChannel const&) = delete;
+
+  // post an update, this can be called from any thread
+  //
+  void post(Key key, Value value)
+  {
+    auto* node = new Node{ std::move(key), std::move(value), m_Head.load(std::memory_order_relaxed) };
+    while (!m_Head.compare_exchange_weak(node->next, node, std::memory_order_release, std::memory_order_relaxed)) {
+    }
+
+    // only the first update of a frame schedules the drain
+    if (!m_Scheduled.exchange(true)) {
+      QMetaObject::invokeMethod(m_Context, [this] { schedule(); }, Qt::QueuedConnection);
+    }
+  }
+
+  // drain and apply the pending updates immediately, this must be called from the
+  // GUI thread
+  //
+  void flush()
+  {
+    m_Timer.stop();
+    drain();
+  }
+
+private:
+
+  struct Node {
+    Key key;
+    Value value;
+    Node* next;
+  };
+
+  static void deleteNodes(Node* node)
+  {
+    while (node != nullptr) {
+      delete std::exchange(node, node->next);
+    }
+  }
+
+  // start the timer for the next frame
+  //
+  void schedule()
+  {
+    if (!m_Timer.isActive()) {
+      const auto elapsed = m_LastFrame.elapsed();
+      m_Timer.start(elapsed >= FRAME ? 0 : static_cast<int>(FRAME - elapsed));
+    }
+  }
+
+  void drain()
+  {
+    // updates posted from now on schedule another frame
+    m_Scheduled = false;
+    Node* node = m_Head.exchange(nullptr, std::memory_order_acquire);
+    if (node == nullptr) {
+      return;
+    }
+
+    // the stack holds the most recent update first, so it is reversed to merge the
+    // updates in the order they were posted
+    Node* reversed = nullptr;
+    while (node != nullptr) {
+      auto* next = node->next;
+      node->next = reversed;
+      reversed = node;
+      node = next;
+    }
+
+    Batch batch;
+    std::unordered_map<Key, std::size_t> indices;
+    for (node = reversed; node != nullptr; node = node->next) {
+      auto [it, inserted] = indices.try_emplace(node->key, batch.size());
+      if (inserted) {
+        batch.emplace_back(std::move(node->key), std::move(node->value));
+      }
+      else if (m_Merge) {
+        m_Merge(batch[it->second].second, std::move(node->value));
+      }
+      else {
+        batch[it->second].second = std::move(node->value);
+      }
+    }
+    deleteNodes(reversed);
+
+    m_LastFrame.restart();
+    m_Apply(batch);
+  }
+
+  QObject* m_Context;
+  ApplyFunction m_Apply;
+  MergeFunction m_Merge;
+
+  std::atomic<Node*> m_Head{ nullptr };
+  std::atomic<bool> m_Scheduled{ false };
+  QTimer m_Timer;
+  QElapsedTimer m_LastFrame;
+
+};
+
+#endif // RESULTCHANNEL_H
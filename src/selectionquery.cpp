@@ -0,0 +1,202 @@
+/*
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This file is part of Mod Organizer.
+
+Mod Organizer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Mod Organizer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Mod Organizer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include "selectionquery.h"
+#include "pathbuilder.h"
+
+#include <algorithm>
+
+#include <QRegularExpression>
+
+SelectionQuery& SelectionQuery::patterns(QStringList patterns)
+{
+  m_Patterns.clear();
+  for (auto& pattern : patterns) {
+    pattern = pattern.trimmed();
+    if (pattern.isEmpty()) {
+      continue;
+    }
+    pattern.replace('\\', '/');
+    if (!pattern.contains('*') && !pattern.contains('?') && !pattern.contains('[') && !pattern.contains('/')) {
+      pattern = "*." + (pattern.startsWith('.') ? pattern.mid(1) : pattern);
+    }
+    m_Patterns.append(pattern);
+  }
+  return *this;
+}
+
+SelectionQuery& SelectionQuery::patterns(QString const& patterns)
+{
+  return this->patterns(patterns.split(QRegularExpression("[\\s,;]+")));
+}
+
+SelectionQuery& SelectionQuery::sizes(std::uint64_t min, std::uint64_t max)
+{
+  m_MinSize = min;
+  m_MaxSize = max;
+  return *this;
+}
+
+SelectionQuery& SelectionQuery::type(Type type)
+{
+  m_Type = type;
+  return *this;
+}
+
+SelectionQuery& SelectionQuery::scope(Index scope)
+{
+  m_Scope = scope;
+  return *this;
+}
+
+SelectionQuery::Set SelectionQuery::evaluate(FlatFileTree const& tree) const
+{
+  Set result(tree.size(), 0);
+  if (m_Scope >= tree.size()) {
+    return result;
+  }
+
+  std::vector<QRegularExpression> nameExpressions, pathExpressions;
+  for (auto& pattern : m_Patterns) {
+    (pattern.contains('/') ? pathExpressions : nameExpressions).emplace_back(
+      QRegularExpression::wildcardToRegularExpression(pattern), QRegularExpression::CaseInsensitiveOption);
+  }
+  auto matches = [](std::vector<QRegularExpression> const& expressions, QString const& subject) {
+    return std::any_of(expressions.begin(), expressions.end(), [&](auto const& expression) {
+      return expression.match(subject).hasMatch();
+    });
+  };
+
+  // names are shared between nodes, so the patterns are only matched once per
+  // distinct name
+  Set names(tree.names().size(), m_Patterns.isEmpty() ? 1 : 0);
+  if (!nameExpressions.empty()) {
+    for (std::size_t i = 0; i < names.size(); ++i) {
+      names[i] = matches(nameExpressions, tree.names()[i]);
+    }
+  }
+
+  // paths are generated in a single pass over the scope
+  Set paths;
+  if (!pathExpressions.empty()) {
+    paths.resize(tree.size(), 0);
+    PathBuilder().forEach(tree, m_Scope, [&](Index i, QStringView path) {
+      paths[i] = matches(pathExpressions, path.toString());
+    });
+  }
+  const std::uint8_t* pathFlags = paths.empty() ? nullptr : paths.data();
+
+  // the remaining tests are branch-free over the contiguous arrays
+  auto& types = tree.types();
+  auto& sizes = tree.sizes();
+  auto& nameIndices = tree.nameIndices();
+  const std::uint8_t anyType = m_Type == Type::ANY;
+  const std::uint8_t type = m_Type == Type::DIRECTORIES ? FlatFileTree::DIRECTORY : FlatFileTree::FILE;
+
+  const Index end = tree.subtreeEnd(m_Scope);
+  for (Index i = m_Scope + 1; i < end; ++i) {
+    result[i] = (anyType | (types[i] == type))
+      & (names[nameIndices[i]] | (pathFlags != nullptr ? pathFlags[i] : 0))
+      & (sizes[i] >= m_MinSize)
+      & (sizes[i] <= m_MaxSize);
+  }
+
+  return result;
+}
+
+SelectionQuery::Set SelectionQuery::nodes(FlatFileTree const& tree, std::vector<Index> const& nodes, bool subtrees)
+{
+  Set set(tree.size(), 0);
+  for (Index i : nodes) {
+    std::fill(set.begin() + i, set.begin() + (subtrees ? tree.subtreeEnd(i) : i + 1), 1);
+  }
+  return set;
+}
+
+void SelectionQuery::unite(Set& lhs, Set const& rhs)
+{
+  for (std::size_t i = 0; i < lhs.size(); ++i) {
+    lhs[i] |= rhs[i];
+  }
+}
+
+void SelectionQuery::intersect(Set& lhs, Set const& rhs)
+{
+  for (std::size_t i = 0; i < lhs.size(); ++i) {
+    lhs[i] &= rhs[i];
+  }
+}
+
+void SelectionQuery::subtract(Set& lhs, Set const& rhs)
+{
+  for (std::size_t i = 0; i < lhs.size(); ++i) {
+    lhs[i] &= !rhs[i];
+  }
+}
+
+void SelectionQuery::invert(FlatFileTree const& tree, Set& set, Index scope)
+{
+  const Index end = tree.subtreeEnd(scope);
+  std::fill(set.begin(), set.begin() + scope + 1, 0);
+  for (Index i = scope + 1; i < end; ++i) {
+    set[i] = !set[i];
+  }
+  std::fill(set.begin() + end, set.end(), 0);
+}
+
+std::size_t SelectionQuery::count(Set const& set)
+{
+  return std::count_if(set.begin(), set.end(), [](auto flag) { return flag != 0; });
+}
+
+std::vector<SelectionQuery::Index> SelectionQuery::cover(
+  FlatFileTree const& tree, Set const& set, Index scope, bool compact)
+{
+  // full[i] is set if everything under the node is in the set (the flag of the
+  // directory itself is ignored, e.g., after inverting the selection of a file, its
+  // folder is in the set but not all of its content), nodes are in pre-order so the
+  // children of a node are processed before the node itself
+  Set full = set;
+  if (compact) {
+    for (Index i = tree.subtreeEnd(scope); i-- > scope + 1;) {
+      if (tree.isDir(i) && tree.childCount(i) > 0) {
+        bool all = true;
+        for (std::size_t n = 0; n < tree.childCount(i) && all; ++n) {
+          all = full[tree.child(i, n)] != 0;
+        }
+        full[i] = all;
+      }
+    }
+  }
+
+  std::vector<Index> nodes;
+  for (Index i = scope + 1, end = tree.subtreeEnd(scope); i < end;) {
+    if (full[i]) {
+      nodes.push_back(i);
+      i = tree.subtreeEnd(i);
+    }
+    else {
+      ++i;
+    }
+  }
+
+  return nodes;
+}
@@ -0,0 +1,127 @@
+/*
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This file is part of Mod Organizer.
+
+Mod Organizer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Mod Organizer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Mod Organizer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#ifndef SELECTIONQUERY_H
+#define SELECTIONQUERY_H
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include <QStringList>
+
+#include "flattree.h"
+
+// predicate-based selection over the flat image of an archive
+//
+// a query combines a set of name patterns, a range of sizes and a type, and is
+// evaluated in a single linear pass over the arrays of the image: the patterns are
+// only matched once per distinct name, and each node is then tested with a few
+// comparisons on the contiguous arrays
+//
+// results are sets with one flag per node of the image, that can be combined with
+// the usual set operations before being reduced to the nodes to select
+//
+class SelectionQuery {
+public:
+
+  using Index = FlatFileTree::Index;
+
+  // one flag per node of the image, non-zero if the node is in the set
+  //
+  using Set = std::vector<std::uint8_t>;
+
+  enum class Type {
+    ANY,
+    FILES,
+    DIRECTORIES
+  };
+
+public:
+
+  // the query matches the files under the root of the image by default
+  //
+  SelectionQuery() = default;
+
+  // only match nodes whose name matches one of the given wildcard patterns (case
+  // insensitive), a pattern without wildcard matches the extension, e.g. "psd"
+  // matches "*.psd", and patterns containing a separator are matched against the
+  // path relative to the scope, e.g. "textures/*.dds"
+  //
+  SelectionQuery& patterns(QStringList patterns);
+
+  // parse a list of patterns separated by spaces, commas or semicolons
+  //
+  SelectionQuery& patterns(QString const& patterns);
+
+  // only match nodes whose size is in the given range, inclusive, the size of a
+  // directory is the total size of the files under it
+  //
+  SelectionQuery& sizes(std::uint64_t min, std::uint64_t max = std::numeric_limits<std::uint64_t>::max());
+
+  SelectionQuery& type(Type type);
+
+  // only match nodes strictly under the given node
+  //
+  SelectionQuery& scope(Index scope);
+  Index scope() const { return m_Scope; }
+
+  // evaluate this query on the given image
+  //
+  Set evaluate(FlatFileTree const& tree) const;
+
+public:
+
+  // the set containing the given nodes and, if subtrees is true, all the nodes
+  // under them
+  //
+  static Set nodes(FlatFileTree const& tree, std::vector<Index> const& nodes, bool subtrees);
+
+  static void unite(Set& lhs, Set const& rhs);
+  static void intersect(Set& lhs, Set const& rhs);
+  static void subtract(Set& lhs, Set const& rhs);
+
+  // invert the set for the nodes strictly under the given node, the other nodes
+  // are removed from the set
+  //
+  static void invert(FlatFileTree const& tree, Set& set, Index scope);
+
+  // the number of nodes in the set
+  //
+  static std::size_t count(Set const& set);
+
+  // reduce the set to the nodes to select under the given node: nodes of the set
+  // whose ancestors are not selected, and, if compact is true, directories whose
+  // content is entirely in the set instead of their content - e.g., inverting the
+  // selection of a folder gives the unselected folders instead of all the files
+  // under them
+  //
+  static std::vector<Index> cover(FlatFileTree const& tree, Set const& set, Index scope, bool compact);
+
+private:
+  QStringList m_Patterns;
+  std::uint64_t m_MinSize = 0;
+  std::uint64_t m_MaxSize = std::numeric_limits<std::uint64_t>::max();
+  Type m_Type = Type::FILES;
+  Index m_Scope = 0;
+};
+
+#endif // SELECTIONQUERY_H
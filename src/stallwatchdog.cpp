@@ -0,0 +1,143 @@
+/*
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This file is part of Mod Organizer.
+
+Mod Organizer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Mod Organizer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Mod Organizer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "stallwatchdog.h"
+
+#include <algorithm>
+
+#include <log.h>
+
+using namespace MOBase;
+
+std::mutex StallWatchdog::s_ScopeMutex;
+StallWatchdog::Scope* StallWatchdog::s_Current = nullptr;
+
+StallWatchdog::Scope::Scope(const char* name, QString context) :
+  m_Name(name), m_Context(std::move(context))
+{
+  std::scoped_lock lock(s_ScopeMutex);
+  m_Previous = s_Current;
+  s_Current = this;
+}
+
+StallWatchdog::Scope::~Scope()
+{
+  std::scoped_lock lock(s_ScopeMutex);
+  s_Current = m_Previous;
+}
+
+StallWatchdog::StallWatchdog(int threshold, QObject* parent) :
+  QObject(parent), m_Threshold(threshold),
+
+  // a few beats per threshold, so that stalls are measured with a reasonable
+  // precision
+  m_Interval(std::max(threshold / 4, 10))
+{
+  m_Heartbeat.setInterval(static_cast<int>(m_Interval.count()));
+  connect(&m_Heartbeat, &QTimer::timeout, this, &StallWatchdog::beat);
+}
+
+StallWatchdog::~StallWatchdog()
+{
+  stop();
+}
+
+void StallWatchdog::setContext(QString context)
+{
+  std::scoped_lock lock(m_Mutex);
+  m_Context = std::move(context);
+}
+
+void StallWatchdog::start()
+{
+  if (m_Thread.joinable()) {
+    return;
+  }
+
+  beat();
+  m_Running = true;
+  m_Heartbeat.start();
+  m_Thread = std::thread([this] { monitor(); });
+}
+
+void StallWatchdog::stop()
+{
+  if (!m_Thread.joinable()) {
+    return;
+  }
+
+  m_Heartbeat.stop();
+  {
+    std::scoped_lock lock(m_Mutex);
+    m_Running = false;
+  }
+  m_Wake.notify_all();
+  m_Thread.join();
+}
+
+void StallWatchdog::beat()
+{
+  m_LastBeat = std::chrono::duration_cast<std::chrono::milliseconds>(
+    Clock::now().time_since_epoch()).count();
+}
+
+QString StallWatchdog::currentOperation()
+{
+  if (s_Current == nullptr) {
+    return "no instrumented operation";
+  }
+
+  QString operation = s_Current->m_Name;
+  if (!s_Current->m_Context.isEmpty()) {
+    operation += " (" + s_Current->m_Context + ")";
+  }
+  for (auto* scope = s_Current->m_Previous; scope != nullptr; scope = scope->m_Previous) {
+    operation += QString(" in ") + scope->m_Name;
+  }
+  return operation;
+}
+
+void StallWatchdog::monitor()
+{
+  // beat at which the current stall started, if any
+  std::int64_t stalledAt = -1;
+
+  std::unique_lock lock(m_Mutex);
+  while (!m_Wake.wait_for(lock, m_Interval, [this] { return !m_Running; })) {
+    const std::int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+      Clock::now().time_since_epoch()).count();
+    const std::int64_t last = m_LastBeat;
+
+    if (stalledAt >= 0) {
+      if (last != stalledAt) {
+        log::info("install dialog responsive again after {}ms", last - stalledAt);
+        stalledAt = -1;
+      }
+    }
+    else if (now - last > m_Threshold.count()) {
+      QString operation;
+      {
+        std::scoped_lock scopeLock(s_ScopeMutex);
+        operation = currentOperation();
+      }
+      log::warn("install dialog not responding for {}ms, during {} [{}]", now - last, operation, m_Context);
+      stalledAt = last;
+    }
+  }
+}
@@ -0,0 +1,118 @@
+/*
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This file is part of Mod Organizer.
+
+Mod Organizer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Mod Organizer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Mod Organizer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef STALLWATCHDOG_H
+#define STALLWATCHDOG_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include <QObject>
+#include <QString>
+#include <QTimer>
+
+// watchdog detecting stalls of the event loop of the GUI thread
+//
+// a heartbeat timer on the GUI thread records the time of each beat, and a monitor
+// thread checks that beats keep coming - when no beat has been recorded for longer
+// than the threshold, the operation currently running on the GUI thread (see Scope)
+// is written to the log, along with the context given by the dialog
+//
+class StallWatchdog : public QObject
+{
+  Q_OBJECT
+
+public:
+
+  // mark an instrumented operation running on the GUI thread for the lifetime of
+  // the scope, scopes can be nested, in which case the innermost one is reported
+  //
+  // scopes are cheap and can be created whether a watchdog is running or not, but
+  // must only be created on the GUI thread
+  //
+  class Scope {
+  public:
+
+    // the name must be a string literal, the context should describe the size of
+    // the data the operation works on
+    //
+    Scope(const char* name, QString context = {});
+    ~Scope();
+
+    Scope(Scope const&) = delete;
+    Scope& operator=(Scope const&) = delete;
+
+  private:
+    const char* m_Name;
+    QString m_Context;
+    Scope* m_Previous;
+  };
+
+public:
+
+  // create a watchdog reporting stalls longer than the given threshold, in milliseconds,
+  // the watchdog is not started
+  //
+  StallWatchdog(int threshold, QObject* parent = nullptr);
+  ~StallWatchdog();
+
+  // set the context reported with every stall (e.g. the size of the tree)
+  //
+  void setContext(QString context);
+
+  // start or stop monitoring, this must be called from the GUI thread
+  //
+  void start();
+  void stop();
+
+private:
+
+  using Clock = std::chrono::steady_clock;
+
+  void beat();
+  void monitor();
+
+  // describe the current operation, must be called with the scope mutex held
+  //
+  static QString currentOperation();
+
+  const std::chrono::milliseconds m_Threshold;
+  const std::chrono::milliseconds m_Interval;
+  QTimer m_Heartbeat;
+
+  // time of the last beat, in milliseconds since the epoch of the clock
+  std::atomic<std::int64_t> m_LastBeat{ 0 };
+
+  std::thread m_Thread;
+  std::mutex m_Mutex;
+  std::condition_variable m_Wake;
+  bool m_Running = false;
+  QString m_Context;
+
+  // innermost running scope, protected by the scope mutex
+  static std::mutex s_ScopeMutex;
+  static Scope* s_Current;
+
+};
+
+#endif // STALLWATCHDOG_H
@@ -0,0 +1,179 @@
+/*
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This file is part of Mod Organizer.
+
+Mod Organizer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Mod Organizer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Mod Organizer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "taskscheduler.h"
+
+#include <algorithm>
+
+#include <log.h>
+
+using namespace MOBase;
+
+// the scheduler and index of the worker running on this thread, if any
+static thread_local const TaskScheduler* t_Scheduler = nullptr;
+static thread_local std::size_t t_Worker = 0;
+
+TaskScheduler::TaskScheduler(int threads)
+{
+  if (threads <= 0) {
+    threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()) - 1);
+  }
+
+  for (int i = 0; i < threads; ++i) {
+    m_Workers.push_back(std::make_unique<Worker>());
+  }
+  for (std::size_t i = 0; i < m_Workers.size(); ++i) {
+    m_Threads.emplace_back([this, i] { work(i); });
+  }
+}
+
+TaskScheduler::~TaskScheduler()
+{
+  {
+    std::scoped_lock lock(m_Mutex);
+    m_Stopping = true;
+  }
+  m_Wake.notify_all();
+
+  for (auto& thread : m_Threads) {
+    thread.join();
+  }
+}
+
+void TaskScheduler::push(Priority priority, Task task)
+{
+  // tasks submitted by a task stay on the same worker, they are usually related
+  const std::size_t index = t_Scheduler == this ? t_Worker : m_Next++ % m_Workers.size();
+
+  // the task is counted before it is published, otherwise a worker could take it
+  // and decrement the count before it is incremented
+  {
+    std::scoped_lock lock(m_Mutex);
+    ++m_Pending;
+  }
+
+  {
+    auto& worker = *m_Workers[index];
+    std::scoped_lock lock(worker.mutex);
+    worker.queues[static_cast<int>(priority)].push_back(std::move(task));
+  }
+  m_Wake.notify_one();
+}
+
+std::optional<TaskScheduler::Task> TaskScheduler::take(std::size_t index)
+{
+  for (int priority = 0; priority < 2; ++priority) {
+
+    // the most recent task of the worker, which is the most likely to be related
+    // to the one it just finished
+    {
+      auto& queue = m_Workers[index]->queues[priority];
+      std::scoped_lock lock(m_Workers[index]->mutex);
+      if (!queue.empty()) {
+        Task task = std::move(queue.back());
+        queue.pop_back();
+        return task;
+      }
+    }
+
+    // the oldest task of the other workers
+    for (std::size_t i = 1; i < m_Workers.size(); ++i) {
+      auto& victim = *m_Workers[(index + i) % m_Workers.size()];
+      std::scoped_lock lock(victim.mutex);
+      auto& queue = victim.queues[priority];
+      if (!queue.empty()) {
+        Task task = std::move(queue.front());
+        queue.pop_front();
+        return task;
+      }
+    }
+  }
+
+  return std::nullopt;
+}
+
+void TaskScheduler::work(std::size_t index)
+{
+  t_Scheduler = this;
+  t_Worker = index;
+
+  while (true) {
+    if (auto task = take(index)) {
+      bool stopping;
+      {
+        std::scoped_lock lock(m_Mutex);
+        --m_Pending;
+        stopping = m_Stopping;
+      }
+      execute(*task, !stopping);
+      continue;
+    }
+
+    std::unique_lock lock(m_Mutex);
+    m_Wake.wait(lock, [this] { return m_Stopping || m_Pending > 0; });
+    if (m_Stopping && m_Pending == 0) {
+      return;
+    }
+  }
+}
+
+void TaskScheduler::execute(Task& task, bool run)
+{
+  using std::chrono::duration_cast;
+  using std::chrono::microseconds;
+
+  const auto start = Clock::now();
+  const bool ran = task.run(run);
+  const auto end = Clock::now();
+
+  std::scoped_lock lock(m_StatisticsMutex);
+  auto& statistics = m_Statistics[task.name];
+  if (ran) {
+    const auto running = duration_cast<microseconds>(end - start).count();
+    ++statistics.runs;
+    statistics.queued += duration_cast<microseconds>(start - task.submitted).count();
+    statistics.running += running;
+    statistics.longest = std::max(statistics.longest, static_cast<std::int64_t>(running));
+  }
+  else {
+    ++statistics.skipped;
+  }
+}
+
+std::map<std::string, TaskScheduler::TaskStatistics> TaskScheduler::statistics() const
+{
+  std::scoped_lock lock(m_StatisticsMutex);
+  return m_Statistics;
+}
+
+void TaskScheduler::logStatistics() const
+{
+  for (auto& [name, statistics] : this->statistics()) {
+    if (statistics.runs == 0) {
+      log::debug("task '{}': {} skipped", name, statistics.skipped);
+      continue;
+    }
+
+    const auto runs = static_cast<std::int64_t>(statistics.runs);
+    log::debug("task '{}': {} runs, {} skipped, {}us queued and {}us running on average, longest {}us",
+      name, statistics.runs, statistics.skipped, statistics.queued / runs, statistics.running / runs,
+      statistics.longest);
+  }
+}
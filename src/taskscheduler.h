@@ -0,0 +1,208 @@
+/*
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This file is part of Mod Organizer.
+
+Mod Organizer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Mod Organizer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Mod Organizer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef TASKSCHEDULER_H
+#define TASKSCHEDULER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// token telling a task that its result is not needed anymore, tokens are created
+// by a CancellationSource and are cancelled as soon as the source advances to a new
+// generation, a default-constructed token is never cancelled
+//
+class CancellationToken
+{
+public:
+
+  CancellationToken() = default;
+
+  bool cancelled() const {
+    return m_Current != nullptr && m_Current->load() != m_Generation;
+  }
+
+private:
+
+  friend class CancellationSource;
+
+  CancellationToken(std::shared_ptr<const std::atomic<std::uint64_t>> current, std::uint64_t generation) :
+    m_Current(std::move(current)), m_Generation(generation) { }
+
+  std::shared_ptr<const std::atomic<std::uint64_t>> m_Current;
+  std::uint64_t m_Generation = 0;
+};
+
+// source of cancellation tokens, advanced every time the data the tasks work on
+// changes (e.g. every edit of the tree)
+//
+class CancellationSource
+{
+public:
+
+  CancellationSource() : m_Current(std::make_shared<std::atomic<std::uint64_t>>(0)) { }
+
+  // cancel all the tokens created so far
+  //
+  void advance() { ++*m_Current; }
+
+  // create a token for the current generation
+  //
+  CancellationToken token() const { return { m_Current, m_Current->load() }; }
+
+private:
+  std::shared_ptr<std::atomic<std::uint64_t>> m_Current;
+};
+
+
+// small work-stealing scheduler for the background work of the installation dialog
+//
+// each worker has its own queues, tasks submitted from a worker go to its queues and
+// other tasks are distributed among the workers, idle workers steal tasks from the
+// others - interactive tasks (the user is waiting for them) always run before
+// background tasks
+//
+// tasks whose token is cancelled when they are about to start are skipped, and the
+// time spent queued and running is recorded for each task name
+//
+class TaskScheduler
+{
+public:
+
+  enum class Priority {
+    INTERACTIVE = 0,
+    BACKGROUND = 1
+  };
+
+  struct TaskStatistics {
+    std::size_t runs = 0;
+    std::size_t skipped = 0;
+
+    // total and longest durations, in microseconds
+    std::int64_t queued = 0;
+    std::int64_t running = 0;
+    std::int64_t longest = 0;
+  };
+
+public:
+
+  // create a scheduler with the given number of workers, or one less than the
+  // number of cores if 0
+  //
+  explicit TaskScheduler(int threads = 0);
+
+  // tasks that have not started yet are skipped
+  //
+  ~TaskScheduler();
+
+  TaskScheduler(TaskScheduler const&) = delete;
+  TaskScheduler& operator=(TaskScheduler const&) = delete;
+
+  // submit the given task, the future holds no value if the task was skipped, the
+  // name must be a string literal
+  //
+  template <class F, class R = std::invoke_result_t<F>>
+  std::future<std::optional<R>> submit(
+    const char* name, Priority priority, F task, CancellationToken token = {})
+  {
+    auto promise = std::make_shared<std::promise<std::optional<R>>>();
+    auto future = promise->get_future();
+
+    // std::function requires a copyable function
+    auto shared = std::make_shared<F>(std::move(task));
+    push(priority, { name, Clock::now(), [promise, shared, token = std::move(token)](bool run) {
+      if (!run || token.cancelled()) {
+        promise->set_value(std::nullopt);
+        return false;
+      }
+      try {
+        promise->set_value((*shared)());
+      }
+      catch (...) {
+        promise->set_exception(std::current_exception());
+      }
+      return true;
+    } });
+
+    return future;
+  }
+
+  // the statistics of the tasks, by name
+  //
+  std::map<std::string, TaskStatistics> statistics() const;
+
+  // write the statistics of the tasks to the log
+  //
+  void logStatistics() const;
+
+private:
+
+  using Clock = std::chrono::steady_clock;
+
+  struct Task {
+    const char* name;
+    Clock::time_point submitted;
+
+    // run (or skip if false) the task, return false if the task was skipped
+    std::function<bool(bool)> run;
+  };
+
+  struct Worker {
+    std::mutex mutex;
+    std::deque<Task> queues[2];
+  };
+
+  void push(Priority priority, Task task);
+
+  // take a task from the queues of the given worker, or steal one from the others
+  //
+  std::optional<Task> take(std::size_t index);
+
+  void work(std::size_t index);
+  void execute(Task& task, bool run);
+
+  std::vector<std::unique_ptr<Worker>> m_Workers;
+  std::vector<std::thread> m_Threads;
+  std::atomic<std::size_t> m_Next{ 0 };
+
+  // number of queued tasks, workers sleep when there is none
+  std::mutex m_Mutex;
+  std::condition_variable m_Wake;
+  std::size_t m_Pending = 0;
+  bool m_Stopping = false;
+
+  mutable std::mutex m_StatisticsMutex;
+  std::map<std::string, TaskStatistics> m_Statistics;
+
+};
+
+#endif // TASKSCHEDULER_H
@@ -0,0 +1,128 @@
+/*
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This file is part of Mod Organizer.
+
+Mod Organizer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Mod Organizer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Mod Organizer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "treesnapshot.h"
+
+using namespace MOBase;
+
+void FileTreeSnapshot::walk(Entry from, std::function<void(QString const&, Entry)> const& callback, QChar separator) const
+{
+  // the path buffer is shared by the whole traversal, each level only appends
+  // its name and truncates back when done
+  QString path;
+  std::function<void(Entry)> visit = [&](Entry entry) {
+    const int length = path.size();
+    for (std::size_t i = 0; i < entry.childCount(); ++i) {
+      auto child = entry.child(i);
+      path.append(child.name());
+      callback(path, child);
+      if (child.isDir()) {
+        path.append(separator);
+        visit(child);
+      }
+      path.truncate(length);
+    }
+  };
+  visit(from);
+}
+
+std::shared_ptr<const FileTreeSnapshot> FileTreeSnapshotBuilder::build(
+  std::shared_ptr<const IFileTree> tree, std::uint64_t generation)
+{
+  if (m_Last && !m_Dirty && m_LastTree.lock() == tree) {
+    if (m_Last->m_Generation != generation) {
+      auto snapshot = std::make_shared<FileTreeSnapshot>();
+      snapshot->m_Generation = generation;
+      snapshot->m_Root = m_Last->m_Root;
+      m_Last = snapshot;
+    }
+    return m_Last;
+  }
+
+  auto snapshot = std::make_shared<FileTreeSnapshot>();
+  snapshot->m_Generation = generation;
+  snapshot->m_Root = buildNode(tree);
+
+  m_Last = snapshot;
+  m_LastTree = tree;
+  m_Dirty = false;
+  return m_Last;
+}
+
+std::shared_ptr<const FileTreeSnapshotBuilder::Node> FileTreeSnapshotBuilder::buildNode(std::shared_ptr<const FileTreeEntry> entry)
+{
+  auto it = m_Nodes.find(entry.get());
+  if (it != m_Nodes.end()) {
+    if (it->second.entry.lock() == entry) {
+      return it->second.node;
+    }
+    // the cached entry was freed and this is a new one at the same address
+    m_Nodes.erase(it);
+  }
+
+  auto node = std::make_shared<Node>();
+  node->name = entry->name();
+  node->dir = entry->isDir();
+  node->key = entry.get();
+  node->fileCount = node->dir ? 0 : 1;
+
+  if (node->dir) {
+    auto tree = entry->astree();
+    node->children.reserve(tree->size());
+    for (auto& child : *tree) {
+      auto childNode = buildNode(child);
+      node->fileCount += childNode->fileCount;
+      node->children.push_back(std::move(childNode));
+    }
+  }
+
+  // files never change so only directories are cached
+  if (node->dir) {
+    m_Nodes[entry.get()] = { entry, node };
+  }
+
+  return node;
+}
+
+void FileTreeSnapshotBuilder::invalidate(const FileTreeEntry* entry, bool recursive)
+{
+  m_Dirty = true;
+
+  auto it = m_Nodes.find(entry);
+  if (it == m_Nodes.end()) {
+    return;
+  }
+
+  auto node = it->second.node;
+  m_Nodes.erase(it);
+
+  if (recursive) {
+    for (auto& child : node->children) {
+      if (child->dir) {
+        invalidate(child->key, true);
+      }
+    }
+  }
+}
+
+void FileTreeSnapshotBuilder::clear()
+{
+  m_Nodes.clear();
+  m_Dirty = true;
+}
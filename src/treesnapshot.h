@@ -0,0 +1,184 @@
+/*
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This file is part of Mod Organizer.
+
+Mod Organizer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Mod Organizer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Mod Organizer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TREESNAPSHOT_H
+#define TREESNAPSHOT_H
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <QString>
+
+#include "ifiletree.h"
+
+// immutable snapshot of a file tree at a given generation
+//
+// the IFileTree modified by the ArchiveTreeWidget is not thread-safe, so worker threads
+// must never access it, instead they are given a snapshot which can be traversed from
+// any number of threads while the GUI keeps modifying the original tree
+//
+// each snapshot has a generation number, which is the generation of the tree widget
+// when the snapshot was created, and can be used to discard results computed on a
+// snapshot that is not up-to-date anymore
+//
+// snapshots share the nodes of unmodified directories with the previous snapshots (see
+// FileTreeSnapshotBuilder), so creating a new snapshot after a small change is cheap
+//
+class FileTreeSnapshot {
+
+  struct Node;
+
+public:
+
+  // handle to an entry in a snapshot, handles are only valid as long as the snapshot
+  // they come from is alive
+  //
+  class Entry {
+  public:
+
+    Entry() = default;
+
+    bool isValid() const { return m_Node != nullptr; }
+
+    const QString& name() const { return m_Node->name; }
+    bool isDir() const { return m_Node->dir; }
+    bool isFile() const { return !m_Node->dir; }
+
+    // number of files under this entry (recursively), 1 for files
+    //
+    std::size_t fileCount() const { return m_Node->fileCount; }
+
+    // children of this entry, in the order of the original tree
+    //
+    std::size_t childCount() const { return m_Node->children.size(); }
+    Entry child(std::size_t i) const { return Entry(m_Node->children[i].get()); }
+
+    // the original entry, this is only meant to be used as a key (e.g. to map results
+    // back to the GUI) and must never be dereferenced outside of the GUI thread
+    //
+    const MOBase::FileTreeEntry* key() const { return m_Node->key; }
+
+    // identity of the node of this entry, nodes are shared between snapshots as long
+    // as their directory is not modified, so two entries with the same identity have
+    // the same content (as long as both snapshots are alive)
+    //
+    const void* identity() const { return m_Node; }
+
+  private:
+
+    friend class FileTreeSnapshot;
+
+    Entry(const Node* node) : m_Node(node) { }
+
+    const Node* m_Node = nullptr;
+  };
+
+public:
+
+  // retrieve the generation of this snapshot
+  //
+  std::uint64_t generation() const { return m_Generation; }
+
+  // retrieve the root of this snapshot
+  //
+  Entry root() const { return Entry(m_Root.get()); }
+
+  // call the given function for every entry under the given one (excluded) in
+  // depth-first order, with the path of the entry relative to the given one
+  //
+  void walk(Entry from, std::function<void(QString const&, Entry)> const& callback, QChar separator = '\\') const;
+
+private:
+
+  friend class FileTreeSnapshotBuilder;
+
+  struct Node {
+    QString name;
+    bool dir;
+    const MOBase::FileTreeEntry* key;
+    std::size_t fileCount;
+    std::vector<std::shared_ptr<const Node>> children;
+  };
+
+  std::uint64_t m_Generation = 0;
+  std::shared_ptr<const Node> m_Root;
+
+};
+
+
+// create snapshots of a file tree, reusing the nodes of the directories that have
+// not been invalidated since the previous snapshot
+//
+// this must only be used from the GUI thread, and any change to the tree must be
+// notified through invalidate()
+//
+class FileTreeSnapshotBuilder {
+public:
+
+  /**
+   * @brief Create a snapshot of the given tree.
+   *
+   * @param tree The tree to create a snapshot of.
+   * @param generation The generation of the tree.
+   *
+   * @return the snapshot, which is the previous one if nothing has been invalidated
+   *     since then.
+   */
+  std::shared_ptr<const FileTreeSnapshot> build(
+    std::shared_ptr<const MOBase::IFileTree> tree, std::uint64_t generation);
+
+  /**
+   * @brief Invalidate the given entry, so that its node is rebuilt in the next
+   *     snapshot. If recursive is true, all the nodes under it are also invalidated.
+   *
+   * Invalidating an entry does not invalidate its parents, so any change must
+   * invalidate the parent chain of the modified entry.
+   */
+  void invalidate(const MOBase::FileTreeEntry* entry, bool recursive = false);
+
+  /**
+   * @brief Invalidate all the nodes.
+   */
+  void clear();
+
+private:
+
+  using Node = FileTreeSnapshot::Node;
+
+  std::shared_ptr<const Node> buildNode(std::shared_ptr<const MOBase::FileTreeEntry> entry);
+
+  // the entries are only used as keys, but directories merged into others are freed
+  // without being invalidated and their address can be reused by a new directory,
+  // so each cached node keeps a weak reference to its entry to detect this
+  struct CachedNode {
+    std::weak_ptr<const MOBase::FileTreeEntry> entry;
+    std::shared_ptr<const Node> node;
+  };
+
+  std::unordered_map<const MOBase::FileTreeEntry*, CachedNode> m_Nodes;
+  std::shared_ptr<const FileTreeSnapshot> m_Last;
+  std::weak_ptr<const MOBase::IFileTree> m_LastTree;
+  bool m_Dirty = true;
+
+};
+
+#endif // TREESNAPSHOT_H